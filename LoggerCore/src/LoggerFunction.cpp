@@ -2,7 +2,7 @@
 #include "LoggerFunction.h"
 #include "LoggerFunctionReturns.h"
 
-Variant LoggerFunction::Command::toVariant() {
+Variant LoggerFunction::Command::toVariant(int text_values_idx, int numeric_units_idx) {
     Variant var;
     var.set("c", cmd);
     if (allow_numeric_values) {
@@ -13,18 +13,24 @@ Variant LoggerFunction::Command::toVariant() {
         // value attribute is optional (1 = shorter in JSON than true)
         var.set("o", 1);
     }
-    if (!text_values.isEmpty()) {
+    if (!text_values.isEmpty() && text_values_idx >= 0) {
+        // allowed values are in the dictionary
+        var.set("v", text_values_idx);
+    } else if (!text_values.isEmpty()) {
         // what are the allowed values?
         Variant vals;
         for (size_t i = 0; i < text_values.size(); ++i)
-            vals.append(text_values[i].c_str());
+            vals.append(LoggerFunctionStrings::get(text_values[i]));
         var.set("v", vals);
     }
-    if (allow_numeric_values && !numeric_units.isEmpty()) {
+    if (allow_numeric_values && !numeric_units.isEmpty() && numeric_units_idx >= 0) {
+        // allowed units are in the dictionary
+        var.set("u", numeric_units_idx);
+    } else if (allow_numeric_values && !numeric_units.isEmpty()) {
         // what units are allowed?
         Variant units;
         for (size_t i = 0; i < numeric_units.size(); ++i)
-            units.append(numeric_units[i].c_str());
+            units.append(LoggerFunctionStrings::get(numeric_units[i]));
         var.set("u",units);
     }
     return(var);
@@ -41,52 +47,297 @@ Variant LoggerFunction::getCommands() {
     return(cmds);
 }
 
+void LoggerFunction::buildCommandsCatalog() {
+
+    // dictionary of the value/unit lists (shared lists like on/off or ms/sec/min are only stored once)
+    Vector<const Vector<uint16_t>*> dict;
+    auto dictIndex = [&dict](const Vector<uint16_t>& values) -> int {
+        if (values.isEmpty()) return(-1);
+        for (size_t i = 0; i < dict.size(); ++i) {
+            if (dict[i]->size() != values.size()) continue;
+            bool same = true;
+            for (size_t j = 0; same && j < values.size(); ++j)
+                same = ((*dict[i])[j] == values[j]);
+            if (same) return(i);
+        }
+        dict.append(&values);
+        return(dict.size() - 1);
+    };
+
+    // compact version of all active commands
+    Vector<size_t> cmd_idxs;
+    VariantArray compact;
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        if (!m_commands[i].use) continue;
+        Command& cmd = m_commands[i];
+        int values_idx = dictIndex(cmd.text_values);
+        int units_idx = cmd.allow_numeric_values ? dictIndex(cmd.numeric_units) : -1;
+        cmd_idxs.append(i);
+        compact.append(cmd.toVariant(values_idx, units_idx));
+    }
+    Variant dict_var;
+    for (size_t i = 0; i < dict.size(); ++i) {
+        Variant vals;
+        for (size_t j = 0; j < dict[i]->size(); ++j)
+            vals.append(LoggerFunctionStrings::get((*dict[i])[j]));
+        dict_var.append(vals);
+    }
+
+    // return codes (calls only carry the code, clients look up the message here)
+    const Vector<LoggerFunctionReturns::Return>& returns = LoggerFunctionReturns::getReturnCodes();
+
+    // content hash (FNV-1a) over dictionary, commands and return codes
+    Variant all;
+    all.set("d", dict_var);
+    all.set("c", compact);
+    Variant all_codes;
+    for (size_t i = 0; i < returns.size(); ++i)
+        all_codes.set(String(returns[i].code), returns[i].message);
+    all.set("r", all_codes);
+    String all_json = all.toJSON();
+    m_commands_hash = 2166136261UL;
+    for (size_t i = 0; i < all_json.length(); ++i) {
+        m_commands_hash ^= (uint8_t) all_json[i];
+        m_commands_hash *= 16777619UL;
+    }
+    String hash = String::format("%08lx", (unsigned long) m_commands_hash);
+
+    // split into pages that fit into the particle variable
+    // (page numbers are set to a placeholder while sizing the pages so the final numbers always fit)
+    const size_t max_length = particle::protocol::MAX_FUNCTION_ARG_LENGTH - 1;
+    auto newPage = [&hash](bool first, const Variant& dict_var) {
+        Variant page;
+        page.set("h", hash.c_str());
+        page.set("pg", 999);
+        page.set("pgs", 999);
+        if (first) page.set("d", dict_var);
+        return(page);
+    };
+    VariantArray pages;
+    Variant page = newPage(true, dict_var);
+    Variant mods;
+    bool page_empty = true;
+    if (page.toJSON().length() > max_length) {
+        Log.error("commands catalog dictionary is too long and does not fit into the size limit of a particle variable (%d)", max_length);
+        page = newPage(false, dict_var);
+    }
+    for (size_t i = 0; i < compact.size(); ++i) {
+        const char* module = m_commands[cmd_idxs[i]].module;
+        Variant candidate = mods;
+        if (!candidate.has(module))
+            candidate.set(module, Variant());
+        candidate[module].append(compact[i]);
+        page.set("m", candidate);
+        if (page.toJSON().length() <= max_length) {
+            // fits on this page
+            mods = candidate;
+            page_empty = false;
+            continue;
+        }
+        if (!page_empty) {
+            // finish this page and try again on a new one
+            page.set("m", mods);
+            pages.append(page);
+            page = newPage(false, dict_var);
+            mods = Variant();
+            page_empty = true;
+            --i;
+            continue;
+        }
+        // does not even fit on an empty page
+        Log.error("command '%s' is too long and does not fit into the size limit of a particle variable (%d), omitting it from the catalog", 
+            m_commands[cmd_idxs[i]].cmd, max_length);
+        page.set("m", mods);
+    }
+    page.set("m", mods);
+    pages.append(page);
+
+    // return code pages
+    page = newPage(false, dict_var);
+    Variant codes;
+    for (size_t i = 0; i < returns.size(); ++i) {
+        Variant candidate = codes;
+        candidate.set(String(returns[i].code), returns[i].message);
+        page.set("r", candidate);
+        if (page.toJSON().length() <= max_length) {
+            codes = candidate;
+        } else if (!codes.isEmpty()) {
+            page.set("r", codes);
+            pages.append(page);
+            page = newPage(false, dict_var);
+            codes = Variant();
+            --i;
+        } else {
+            Log.error("return code %d message is too long and does not fit into the size limit of a particle variable (%d), omitting it from the catalog", 
+                returns[i].code, max_length);
+        }
+    }
+    if (!codes.isEmpty()) {
+        page.set("r", codes);
+        pages.append(page);
+    }
+
+    // finalize page numbers
+    m_commands_pages.clear();
+    for (size_t i = 0; i < pages.size(); ++i) {
+        pages[i].set("pg", (int) i);
+        pages[i].set("pgs", (int) pages.size());
+        m_commands_pages.append(pages[i].toJSON());
+    }
+    Log.info("commands catalog (hash %s) with %d commands, %d dictionary entries, %d return codes and %d page(s), full JSON would be %d chars", 
+        hash.c_str(), compact.size(), dict.size(), returns.size(), m_commands_pages.size(), getCommands().toJSON().length());
+}
+
+void LoggerFunction::showCommandsPage(size_t page) {
+    if (page >= m_commands_pages.size()) return;
+    snprintf(m_value_available_commands, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", m_commands_pages[page].c_str());
+}
+
+bool LoggerFunction::selectCommandsPage(Variant& call) {
+    using namespace LoggerFunctionReturns;
+    size_t page = 0;
+    if (call.has("vnum")) {
+        double number = call.get("vnum").toDouble();
+        if (number < 0 || number >= m_commands_pages.size() || number != floor(number)) {
+            setReturnValue(call, CALL_ERR_PAGE_UNREC);
+            return(false);
+        }
+        page = (size_t) number;
+    }
+    showCommandsPage(page);
+    return(true);
+}
+
+Variant LoggerFunction::getProfile() {
+    Vector<Command::Stats> snapshot;
+    return(getProfile(snapshot));
+}
+
+Variant LoggerFunction::getProfile(Vector<Command::Stats>& snapshot) {
+
+    // snapshot of the counters (the handler and loop() keep counting while the profile is built)
+    uint32_t parse_errors, rate_rejected;
+    snapshot.clear();
+    snapshot.reserve(m_commands.size());
+    {
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        parse_errors = m_parse_errors;
+        rate_rejected = m_rate_rejected;
+        for (auto& cmd : m_commands) snapshot.append(cmd.stats);
+    }
+
+    Variant profile;
+    profile.set("err", parse_errors);
+    profile.set("rej", rate_rejected);
+    for (size_t i = 0; i < m_commands.size(); ++i) {
+        Command& cmd = m_commands[i];
+        Command::Stats& cmd_stats = snapshot[i];
+        if (!cmd.use || cmd_stats.calls == 0) continue;
+        Variant stats;
+        stats.append(cmd_stats.calls);
+        stats.append(cmd_stats.parse_us / cmd_stats.calls);
+        stats.append(cmd_stats.parse_max_us);
+        stats.append(cmd_stats.executed > 0 ? cmd_stats.exec_us / cmd_stats.executed : 0);
+        stats.append(cmd_stats.exec_max_us);
+        stats.append(cmd_stats.rejected);
+        stats.append(cmd_stats.coalesced);
+        if (m_profile_heap) {
+            stats.append(cmd_stats.executed > 0 ? cmd_stats.heap / (int32_t) cmd_stats.executed : 0);
+            stats.append(cmd_stats.heap_max);
+        }
+        profile.set(cmd.module[0] == '\0' ? String(cmd.cmd) : String(cmd.module) + " " + cmd.cmd, stats);
+    }
+    return(profile);
+}
+
+String LoggerFunction::getProfileJSON() {
+    Vector<Command::Stats> snapshot;
+    Variant profile = getProfile(snapshot);
+    String json = profile.toJSON();
+    // too long --> drop the commands with the fewest calls until it fits
+    while (json.length() >= particle::protocol::MAX_FUNCTION_ARG_LENGTH) {
+        const char* fewest = nullptr;
+        String fewest_key;
+        uint32_t fewest_calls = std::numeric_limits<uint32_t>::max();
+        for (size_t i = 0; i < m_commands.size(); ++i) {
+            Command& cmd = m_commands[i];
+            String key = cmd.module[0] == '\0' ? String(cmd.cmd) : String(cmd.module) + " " + cmd.cmd;
+            if (cmd.use && snapshot[i].calls > 0 && snapshot[i].calls < fewest_calls && profile.has(key)) {
+                fewest = cmd.cmd;
+                fewest_key = key;
+                fewest_calls = snapshot[i].calls;
+            }
+        }
+        if (fewest == nullptr) break;
+        profile.remove(fewest_key.c_str());
+        profile.set("trunc", 1);
+        json = profile.toJSON();
+    }
+    return(json);
+}
+
 void LoggerFunction::setup() {
-    Log.info("registering particle function '%s'", m_function);
-    Particle.function(m_function, &LoggerFunction::receiveCall, this);
+    // return codes are complete (and read-only) before any call can come in
+    LoggerFunctionReturns::registerReturnCodes(LoggerFunctionReturns::CALL_RETURNS);
+    LoggerFunctionReturns::lockReturnCodes();
 
     // available commands variable
     if (m_var_available_commands != nullptr) {
         Log.info("registering particle variable '%s'", m_var_available_commands);
-        String cmds_json = getCommands().toJSON();
-        if (cmds_json.length() < particle::protocol::MAX_FUNCTION_ARG_LENGTH) {
-            // commands fit into the particle variable
-            snprintf(m_value_available_commands, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", cmds_json.c_str());
-        } else {
-            // commands don't fit
-            Variant trunc;
-            trunc.set("trunc", true);
-            trunc.set("error", 
-                String::format("commands are too long (%d chars) and don't fit into the size limit of a particle variable (%d)",
-                    cmds_json.length(), particle::protocol::MAX_FUNCTION_ARG_LENGTH));
-            snprintf(m_value_available_commands, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", trunc.toJSON().c_str());
-        }
+        // built-in command to page through the catalog (part of the catalog itself)
+        registerCommandWithNumericValues(this, &LoggerFunction::selectCommandsPage, m_var_available_commands, {}, true);
+        // page switches are not deferred, the client reads the variable right after the call
+        if (!m_commands.isEmpty() && m_commands.last().cmd_id == LoggerFunctionStrings::find(m_var_available_commands))
+            m_commands.last().immediate = true;
+        buildCommandsCatalog();
+        showCommandsPage(0);
+        Log.info("interned %d module, command, value and unit names (%d bytes)", LoggerFunctionStrings::size(), LoggerFunctionStrings::getBytes());
         Particle.variable(m_var_available_commands, m_value_available_commands);    
     }
 
+    // profile variable (computed when requested)
+    if (m_var_profile != nullptr) {
+        Log.info("registering particle variable '%s'", m_var_profile);
+        Particle.variable(m_var_profile, &LoggerFunction::getProfileJSON, this);
+    }
+
     // last call variable
     if (m_var_last_calls != nullptr) {
         // starting value is just an empty json array since there are no commands yet
         snprintf(m_value_last_calls, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", "[]");
         Particle.variable(m_var_last_calls, m_value_last_calls);
     }
+
+    // start listening to calls
+    Log.info("registering particle function '%s'", m_function);
+    Particle.function(m_function, &LoggerFunction::receiveCall, this);
 }
 
 void LoggerFunction::registerCommand(const std::function<bool(Variant&)>& cb, const char* module, const char* cmd, 
             const Vector<String>& text_values, bool allow_numeric_values,
-            const Vector<String>& numeric_units, bool value_optional) {
+            const Vector<String>& numeric_units, bool value_optional,
+            const LoggerFunctionUnits::Unit* unit_defs) {
     Log.info("registering command '%s' for module '%s'", cmd, module);
 
+    // intern all names
+    uint16_t module_id = LoggerFunctionStrings::intern(module);
+    uint16_t cmd_id = LoggerFunctionStrings::intern(cmd);
+    Vector<uint16_t> text_value_ids, numeric_unit_ids;
+    for (size_t j = 0; j < text_values.size(); ++j)
+        text_value_ids.append(LoggerFunctionStrings::intern(text_values[j].c_str()));
+    for (size_t j = 0; j < numeric_units.size(); ++j)
+        numeric_unit_ids.append(LoggerFunctionStrings::intern(numeric_units[j].c_str()));
+
     // check for issues
     size_t i = 0;
     bool overwrite = false;
     for (; i < m_commands.size(); ++i) {
-        if (strcmp(module, m_commands[i].module) == 0 && strcmp(cmd, m_commands[i].cmd) == 0) {
+        if (module_id == m_commands[i].module_id && cmd_id == m_commands[i].cmd_id) {
             Log.warn("cmd (%s) already exists for this module (%s), overwriting  existing", cmd, module);
             overwrite = true;
             break;
         }
-        if (strcmp(cmd, m_commands[i].module) == 0 || strcmp(module, m_commands[i].cmd) == 0 || strcmp(cmd, module) == 0) {
+        if (cmd_id == m_commands[i].module_id || module_id == m_commands[i].cmd_id || cmd_id == module_id) {
             // should this be here or elsewhere? not sure it's visible on logger startup
             Log.error("identically named module and command (%s) can cause confusion and is not permitted", cmd);
             return;
@@ -96,12 +347,60 @@ void LoggerFunction::registerCommand(const std::function<bool(Variant&)>& cb, co
     // add/overwrite
     if (overwrite)
         m_commands[i].use = false; // flag for ignoring (=overwrite)
-    m_commands.append({cb, module, cmd, text_values, allow_numeric_values, numeric_units, value_optional}); // add
+    m_commands.append({cb, module_id, cmd_id, text_value_ids, allow_numeric_values, numeric_unit_ids, unit_defs, value_optional}); // add
+}
+
+Vector<String> LoggerFunction::getUnitNames(const LoggerFunctionUnits::Units& units) {
+    Vector<String> names;
+    for (size_t i = 0; i < units.size; ++i)
+        names.append(units.units[i].name);
+    return(names);
 }
         
+void LoggerFunction::deferExecution(size_t queue_size) {
+    Log.info("executing commands of particle function '%s' from loop (queue size: %d)", m_function, queue_size);
+    std::lock_guard<std::mutex> lock(m_deferred_mutex);
+    m_deferred_calls.reset(queue_size > 0 ? new DeferredCall[queue_size] : nullptr);
+    m_deferred_size = queue_size;
+    m_deferred_first = 0;
+    m_deferred_n = 0;
+}
+
+void LoggerFunction::loop() {
+
+    // anything queued? (lock-free check so an idle loop() never waits for the handler)
+    if (m_deferred_n.load() == 0) return;
+
+    // take the oldest call out of the queue (moved, not copied)
+    size_t cmd_idx;
+    Variant parsed;
+    {
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        if (m_deferred_n == 0) return;
+        DeferredCall& next = m_deferred_calls[m_deferred_first];
+        cmd_idx = next.cmd_idx;
+        parsed = std::move(next.call);
+        next.call = Variant();
+        m_deferred_first = (m_deferred_first + 1) % m_deferred_size;
+        m_deferred_n--;
+    }
+
+    // execute and report completion
+    executeCall(cmd_idx, parsed);
+    reportCall(parsed);
+}
+
 int LoggerFunction::receiveCall (String call) {
 
     using namespace LoggerFunctionReturns;
+    unsigned long start = micros();
+
+    // global rate limit (checked before parsing so rejected calls cost next to nothing)
+    if (!m_rate_limit.take(millis())) {
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        m_rate_rejected++;
+        return(CALL_ERR_RATE_LIMIT.code);
+    }
 
     // store call and basic info in the Variant and then parse it
     // important: this is NOT a member variable on purpose because variants
@@ -111,6 +410,22 @@ int LoggerFunction::receiveCall (String call) {
     parsed.set("dt", Time.format(Time.now(), "%Y-%m-%d %H:%M:%S %Z"));
     parsed.set("lt", "cmd"); // log type
     size_t cmd_idx = parseCall(parsed); 
+    uint32_t coalesce_hash = 0;
+    uint32_t parse_us = micros() - start;
+    Log.trace("parsed call in %lu us", parse_us);
+
+    // profile (the counters are shared with loop() and the profile variable)
+    {
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        if (cmd_idx == PARSING_ERROR) {
+            m_parse_errors++;
+        } else {
+            Command::Stats& stats = m_commands[cmd_idx].stats;
+            stats.calls++;
+            stats.parse_us += parse_us;
+            if (parse_us > stats.parse_max_us) stats.parse_max_us = parse_us;
+        }
+    }
 
     // any issues? 
     if (cmd_idx == PARSING_ERROR) {
@@ -119,59 +434,216 @@ int LoggerFunction::receiveCall (String call) {
         Log.trace("parsing error: %s", parsed.toJSON().c_str());
         parsed.set("success", false);
 
+    } else if (isCoalesced(cmd_idx, parsed, coalesce_hash)) {
+
+        // same as the last call --> don't execute again and don't report (checked first so it does not use up rate limit tokens)
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        m_commands[cmd_idx].stats.coalesced++;
+        return(CALL_COALESCED.code);
+
+    } else if (!m_commands[cmd_idx].limit.take(millis())) {
+
+        // command rate limit exceeded --> reject without reporting
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        m_commands[cmd_idx].stats.rejected++;
+        m_rate_rejected++;
+        return(CALL_ERR_RATE_LIMIT.code);
+
+    } else if (m_deferred_size > 0 && !m_commands[cmd_idx].immediate) {
+
+        // found a command while parsing, queue the callback for execution in loop()
+        std::unique_lock<std::mutex> lock(m_deferred_mutex);
+        if (m_deferred_n < m_deferred_size) {
+            DeferredCall& slot = m_deferred_calls[(m_deferred_first + m_deferred_n) % m_deferred_size];
+            slot.cmd_idx = cmd_idx;
+            slot.call = std::move(parsed);
+            m_deferred_n++;
+            lock.unlock();
+            // accepted --> reference for coalescing
+            setCoalesced(cmd_idx, coalesce_hash);
+            Log.trace("queued call for execution (%d in queue), handled in %lu us", m_deferred_n.load(), micros() - start);
+            // completion is reported from loop()
+            return(CALL_QUEUED.code);
+        }
+        lock.unlock();
+
+        // queue is full --> error
+        Log.warn("command queue is full (%d calls), rejecting call", m_deferred_size);
+        setReturnValue(parsed, CALL_ERR_QUEUE_FULL);
+        parsed.set("success", false);
+
     }  else {
 
-        // found a command while parsing, execute the callback
-        Log.trace("execute callback with: %s", parsed.toJSON().c_str());
-        bool success = m_commands[cmd_idx].callback(parsed);
-        parsed.set("success", success);
+        // found a command while parsing, execute the callback (accepted --> reference for coalescing)
+        setCoalesced(cmd_idx, coalesce_hash);
+        executeCall(cmd_idx, parsed);
+    }
+
+    // report call (moves parsed to the logger so get the return value first)
+    int ret = getReturnValue(parsed);
+    reportCall(parsed);
+    Log.trace("call handled in %lu us", micros() - start);
+
+    // return return value
+    return(ret);
+}
+
+void LoggerFunction::executeCall(size_t cmd_idx, Variant& parsed) {
+
+    using namespace LoggerFunctionReturns;
 
-        // if no ret val set yet
-        if (success && !hasReturnValue(parsed)) {
-            setSuccess(parsed);
-        } else if (!success && !hasReturnValue(parsed)) {
-            setReturnValue(parsed, CALL_ERR_UNKNOWN);
-        } 
+    // execute the callback
+    Log.trace("execute callback with: %s", parsed.toJSON().c_str());
+    uint32_t mem_before = m_profile_heap ? System.freeMemory() : 0;
+    unsigned long start = micros();
+    bool success = m_commands[cmd_idx].callback(parsed);
+    uint32_t exec_us = micros() - start;
+
+    // profile (counted from the handler or loop(), read by the profile variable)
+    int32_t heap = m_profile_heap ? (int32_t) mem_before - (int32_t) System.freeMemory() : 0;
+    {
+        std::lock_guard<std::mutex> lock(m_deferred_mutex);
+        Command::Stats& stats = m_commands[cmd_idx].stats;
+        stats.executed++;
+        stats.exec_us += exec_us;
+        if (exec_us > stats.exec_max_us) stats.exec_max_us = exec_us;
+        if (m_profile_heap) {
+            stats.heap += heap;
+            if (heap > stats.heap_max) stats.heap_max = heap;
+        }
     }
 
-    // report command to cloud if logging is on
-    if (m_log) {
-        // FIXME: implement
-        // LoggerPublisher::queueData(parsed);
-        // this will also print the published data like below instead of here
-        Log.trace("after callback:");
-        Log.print(parsed.toJSON().c_str());
-        Log.print("\n");
+    parsed.set("success", success);
+
+    // if no ret val set yet
+    if (success && !hasReturnValue(parsed)) {
+        setSuccess(parsed);
+    } else if (!success && !hasReturnValue(parsed)) {
+        setReturnValue(parsed, CALL_ERR_UNKNOWN);
+    } 
+}
+
+bool LoggerFunction::RateLimit::take(unsigned long now) {
+    if (rate <= 0) return(true);
+    tokens += (now - last) * rate / 1000.;
+    if (tokens > burst) tokens = burst;
+    last = now;
+    if (tokens < 1) return(false);
+    tokens -= 1;
+    return(true);
+}
+
+void LoggerFunction::setRateLimit(const char* cmd, float calls_per_sec, uint burst, const char* module) {
+    uint16_t cmd_id = LoggerFunctionStrings::find(cmd);
+    uint16_t module_id = module != nullptr ? LoggerFunctionStrings::find(module) : LoggerFunctionStrings::NOT_FOUND;
+    bool found = false;
+    for (auto& command : m_commands) {
+        if (command.cmd_id != cmd_id || (module != nullptr && command.module_id != module_id)) continue;
+        Log.info("limiting command '%s' of module '%s' to %.2f calls/sec (burst %d)", command.cmd, command.module, calls_per_sec, burst);
+        command.limit.rate = calls_per_sec;
+        command.limit.burst = burst;
+        command.limit.tokens = burst;
+        command.limit.last = millis();
+        found = true;
+    }
+    if (!found) Log.warn("cannot set rate limit, command '%s' is not registered", cmd);
+}
+
+void LoggerFunction::setGlobalRateLimit(float calls_per_sec, uint burst) {
+    Log.info("limiting particle function '%s' to %.2f calls/sec (burst %d)", m_function, calls_per_sec, burst);
+    m_rate_limit.rate = calls_per_sec;
+    m_rate_limit.burst = burst;
+    m_rate_limit.tokens = burst;
+    m_rate_limit.last = millis();
+}
+
+void LoggerFunction::setCoalescing(const char* cmd, uint window_ms, const char* module) {
+    uint16_t cmd_id = LoggerFunctionStrings::find(cmd);
+    uint16_t module_id = module != nullptr ? LoggerFunctionStrings::find(module) : LoggerFunctionStrings::NOT_FOUND;
+    bool found = false;
+    for (auto& command : m_commands) {
+        if (command.cmd_id != cmd_id || (module != nullptr && command.module_id != module_id)) continue;
+        if (!command.expect_value) {
+            Log.warn("command '%s' of module '%s' does not take a value, not coalescing it", command.cmd, command.module);
+            continue;
+        }
+        Log.info("coalescing identical calls of command '%s' of module '%s' within %d ms", command.cmd, command.module, window_ms);
+        command.coalesce_ms = window_ms;
+        found = true;
     }
+    if (!found) Log.warn("cannot set coalescing, command '%s' is not registered", cmd);
+}
+
+bool LoggerFunction::isCoalesced(size_t cmd_idx, Variant& parsed, uint32_t& hash) {
+    Command& cmd = m_commands[cmd_idx];
+    if (cmd.coalesce_ms == 0) return(false);
+    // value (and unit) of the call
+    String value = parsed.get("vtext").toString();
+    value += " ";
+    value += parsed.get("u").toString();
+    hash = LoggerFunctionStrings::hash(value.c_str(), value.length());
+    return(cmd.coalesce_time > 0 && hash == cmd.coalesce_hash && (millis() - cmd.coalesce_time) < cmd.coalesce_ms);
+}
+
+void LoggerFunction::setCoalesced(size_t cmd_idx, uint32_t hash) {
+    Command& cmd = m_commands[cmd_idx];
+    if (cmd.coalesce_ms == 0) return;
+    cmd.coalesce_hash = hash;
+    cmd.coalesce_time = millis();
+}
+
+void LoggerFunction::reportCall(Variant& parsed) {
 
     // update last call variable?
     if (m_var_last_calls != nullptr) {
+
+        // calls can be reported from the system thread (handler) and the application thread (loop)
+        std::lock_guard<std::mutex> lock(m_report_mutex);
         
         // restore from JSON (stored in char to avoid memory fragmentation)
         Variant call_log = Variant::fromJSON(m_value_last_calls);
 
-        // store the last call in the call log
-        call_log.append(parsed);
-        size_t call_log_size = call_log.toJSON().length();
-        while (call_log_size  >= particle::protocol::MAX_FUNCTION_ARG_LENGTH && !call_log.isEmpty()) {
+        // store the last call in the call log (moved in, not copied, it is moved back out for the logger below)
+        call_log.append(std::move(parsed));
+        String json = call_log.toJSON();
+        while (json.length() >= particle::protocol::MAX_FUNCTION_ARG_LENGTH && call_log.size() > 1) {
             // remove the oldest entries until they fit
             call_log.removeAt(0);
-            call_log_size = call_log.toJSON().length();
+            json = call_log.toJSON();
         }
+        // the last call alone does not fit
+        if (json.length() >= particle::protocol::MAX_FUNCTION_ARG_LENGTH) json = "[]";
 
         // set call_log
         if (Log.isTraceEnabled()) {
             Log.trace("new value for Particle.variable('%s') from %d commands in call log stack", m_var_last_calls, call_log.size());
-            Log.print(call_log.toJSON().c_str());
+            Log.print(json.c_str());
             Log.print("\n");
         }
 
         // assign call log
-        snprintf(m_value_last_calls, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", call_log.toJSON().c_str());
+        snprintf(m_value_last_calls, particle::protocol::MAX_FUNCTION_ARG_LENGTH, "%s", json.c_str());
+
+        // take the record back (the last entry of the call log)
+        parsed = std::move(call_log.asArray().last());
     }
 
-    // return return value
-    return(getReturnValue(parsed));
+    // report command to cloud if logging is on
+    if (m_log && m_logger) {
+        // hand over the record (moved, the logger takes care of publishing it)
+        unsigned long start = micros();
+        bool queued = m_logger(std::move(parsed));
+        parsed = Variant();
+        if (queued) 
+            Log.trace("handed over call record for logging in %lu us", micros() - start);
+        else
+            Log.warn("logger did not accept the call record, it is not logged");
+    } else if (m_log) {
+        // no logger, print the record instead
+        Log.trace("after callback:");
+        Log.print(parsed.toJSON().c_str());
+        Log.print("\n");
+    }
 }
 
 size_t LoggerFunction::parseCall(Variant& parsed) {
@@ -194,17 +666,20 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
     // get module
     char *part = strtok(copy.get(), " ");
 
-    // module or cmd exists?
+    // module or cmd exists? (compare interned ids, strings that were never interned match nothing)
+    uint16_t part_id = LoggerFunctionStrings::find(part);
+    uint16_t mod_id = LoggerFunctionStrings::NOT_FOUND;
     bool mod_found = false;
     size_t cmd_idx = 0;
     uint n_cmds_found = 0;
-    for (size_t i = 0; i < m_commands.size(); ++i) {
+    for (size_t i = 0; part_id != LoggerFunctionStrings::NOT_FOUND && i < m_commands.size(); ++i) {
         if (!m_commands[i].use) continue;
-        if (strcmp(part, m_commands[i].module) == 0) {
+        if (part_id == m_commands[i].module_id) {
             parsed.set("m", part);
             mod_found = true;
+            mod_id = part_id;
         }
-        if (strcmp(part, m_commands[i].cmd) == 0) {
+        if (part_id == m_commands[i].cmd_id) {
             Log.trace("cmd match: %s", part);
             parsed.set("c", part);
             n_cmds_found++;
@@ -221,9 +696,10 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
             setReturnValue(parsed, CALL_ERR_CMD_MISS);
             return(PARSING_ERROR);
         }
-        for (size_t i = 0; i < m_commands.size(); ++i) {
+        part_id = LoggerFunctionStrings::find(part);
+        for (size_t i = 0; part_id != LoggerFunctionStrings::NOT_FOUND && i < m_commands.size(); ++i) {
             if (!m_commands[i].use) continue;
-            if (strcmp(parsed.get("m").asString().c_str(), m_commands[i].module) == 0 && strcmp(part, m_commands[i].cmd) == 0) {
+            if (mod_id == m_commands[i].module_id && part_id == m_commands[i].cmd_id) {
                 // found the command
                 Log.trace("cmd match: %s", part);
                 parsed.set("c", part);
@@ -274,8 +750,9 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
             
             // let's see if it matches any of the allowed text values
             if (m_commands[cmd_idx].text_values.size() > 0) {
-                 for (size_t i = 0; i < m_commands[cmd_idx].text_values.size(); ++i) {
-                    if (strcmp(part, m_commands[cmd_idx].text_values[i].c_str()) == 0) {
+                part_id = LoggerFunctionStrings::find(part);
+                for (size_t i = 0; part_id != LoggerFunctionStrings::NOT_FOUND && i < m_commands[cmd_idx].text_values.size(); ++i) {
+                    if (part_id == m_commands[cmd_idx].text_values[i]) {
                         // found the value (already correctly assigned "vtext")
                         Log.trace("value match: %s", part);
                         valid_value = true;
@@ -331,11 +808,17 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
                         parsed.set("u", part);
                     }
                     // check if the units fit any of the expected
-                    for (size_t i = 0; i < m_commands[cmd_idx].numeric_units.size(); ++i) {
-                        if (strcmp(parsed.get("u").asString().c_str(), m_commands[cmd_idx].numeric_units[i].c_str()) == 0) {
+                    uint16_t unit_id = LoggerFunctionStrings::find(*num_end != '\0' ? num_end : part);
+                    for (size_t i = 0; unit_id != LoggerFunctionStrings::NOT_FOUND && i < m_commands[cmd_idx].numeric_units.size(); ++i) {
+                        if (unit_id == m_commands[cmd_idx].numeric_units[i]) {
                             // found the unit (already correctly assigned "u")
-                            Log.trace("unit match: %s", parsed.get("u").asString().c_str());
+                            Log.trace("unit match: %s", LoggerFunctionStrings::get(unit_id));
                             valid_units = true;
+                            if (m_commands[cmd_idx].unit_defs != nullptr) {
+                                // normalize to the canonical unit of the unit table
+                                parsed.set("uid", (int) i);
+                                parsed.set("vnorm", number * m_commands[cmd_idx].unit_defs[i].factor);
+                            }
                             break;
                         }
                     }
@@ -360,10 +843,10 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
         while (part != nullptr) {
             bool new_param = false;
 
-            // starts with a 'param='?
+            // starts with a 'param='? (compared in place, no prefix strings are built)
             for (size_t i = 0; i < m_params.size(); ++i) {
-                String prefix = m_params[i] + "=";
-                if (strncmp(part, prefix.c_str(), prefix.length()) == 0) {
+                size_t param_length = m_params[i].length();
+                if (strncmp(part, m_params[i].c_str(), param_length) == 0 && part[param_length] == '=') {
                     // found a param!
                     if (found_param) {
                         // store the previous param in the variant
@@ -374,7 +857,7 @@ size_t LoggerFunction::parseCall(Variant& parsed) {
                     found_param = true;
                     new_param = true;
                     current_param = i;
-                    param_value = part + prefix.length(); // start new valuew without the prefix
+                    param_value = part + param_length + 1; // start new valuew without the prefix
                     break;
                 }
             }
@@ -1,7 +1,12 @@
 #pragma once
 #include "Particle.h"
+#include <mutex>
+#include <atomic>
 #include "LoggerFunctionReturns.h"
+#include "LoggerFunctionStrings.h"
+#include "LoggerFunctionUnits.h"
 #include "LoggerModule.h"
+#include "LoggerPlatformTraits.h"
 
 /**
  * extension of return codes
@@ -19,6 +24,21 @@ namespace LoggerFunctionReturns {
     inline constexpr Error CALL_ERR_UNIT_UNEXP    = {-11, "unit after number value but no unit was expected"};
     inline constexpr Error CALL_ERR_UNIT_MISS     = {-10, "unit required but none provided"};
     inline constexpr Error CALL_ERR_UNIT_UNREC    = {-12, "unit not recognized"};
+    inline constexpr Error CALL_ERR_QUEUE_FULL    = {-13, "command queue is full, try again later"};
+    inline constexpr Error CALL_ERR_PAGE_UNREC    = {-14, "commands catalog page does not exist"};
+    inline constexpr Error CALL_ERR_RATE_LIMIT    = {-15, "too many calls, rate limit exceeded"};
+    inline constexpr Warning CALL_QUEUED          = {  1, "command queued for execution"};
+    inline constexpr Warning CALL_COALESCED       = {  2, "identical call was just executed, not executing it again"};
+
+    // all return codes of LoggerFunction (published in the commands catalog)
+    // extensions should check their codes against these with hasUniqueCodes(MY_CODES, CALL_RETURNS)
+    inline constexpr Return CALL_RETURNS[] = {
+        {CMD_SUCCESS, "success"}, CALL_ERR_UNKNOWN, CALL_ERR_EMPTY, CALL_ERR_AMBIGUOUS, CALL_ERR_CMD_MOD_UNREC,
+        CALL_ERR_CMD_MISS, CALL_ERR_CMD_UNREC, CALL_ERR_VAL_MISS, CALL_ERR_VAL_NAN, CALL_ERR_VAL_UNREC,
+        CALL_ERR_UNIT_UNEXP, CALL_ERR_UNIT_MISS, CALL_ERR_UNIT_UNREC, CALL_ERR_QUEUE_FULL, CALL_ERR_PAGE_UNREC,
+        CALL_ERR_RATE_LIMIT, CALL_QUEUED, CALL_COALESCED
+    };
+    static_assert(hasUniqueCodes(CALL_RETURNS), "LoggerFunction return codes are not unique");
 }
 
 /**
@@ -34,6 +54,7 @@ class LoggerFunction {
         char m_value_available_commands[particle::protocol::MAX_FUNCTION_ARG_LENGTH];
         const char* m_var_last_calls;
         char m_value_last_calls[particle::protocol::MAX_FUNCTION_ARG_LENGTH];
+        const char* m_var_profile = nullptr; // set with enableProfiling()
 
         // call parameters (xyz=, abc=) to interpret/capture
         const Vector<String> m_params;
@@ -41,32 +62,90 @@ class LoggerFunction {
         // whether to log received calls with LoggerPublisher
         bool m_log;
 
+        // receives the audit record of each call if m_log is true (the record is moved, see setLogger())
+        std::function<bool(Variant&&)> m_logger;
+
         // return value indicating a parsing error
         const size_t PARSING_ERROR = std::numeric_limits<size_t>::max();
 
+        // token bucket rate limit
+        struct RateLimit {
+            float rate = 0; // calls per second (0 = no limit)
+            float burst = 1; // maximum number of calls at once
+            float tokens = 0; // calls currently available
+            unsigned long last = 0; // millis() of the last refill
+
+            // take a token if one is available (refills first)
+            bool take(unsigned long now);
+        };
+
+        // global rate limit for all calls (checked before parsing)
+        RateLimit m_rate_limit;
+        uint32_t m_rate_rejected = 0; // number of calls rejected because of rate limits (global + per command)
+
+        // deferred execution: parsed calls waiting for their callback to run in loop()
+        struct DeferredCall {
+            size_t cmd_idx;
+            Variant call;
+        };
+        std::unique_ptr<DeferredCall[]> m_deferred_calls; // fixed size ring buffer (allocated once)
+        size_t m_deferred_size = 0; // capacity of the ring buffer (0 = execute callbacks immediately)
+        size_t m_deferred_first = 0; // index of the oldest queued call
+        std::atomic<size_t> m_deferred_n{0}; // number of queued calls (atomic: loop() checks it without the lock)
+        std::mutex m_deferred_mutex; // guards the ring buffer (filled from the system thread, drained from loop) and the profiling counters
+        std::mutex m_report_mutex; // guards the last calls variable
+
         // command object for registering commands
+        // names, text values and units are interned (LoggerFunctionStrings) and matched by id
         struct Command {
             std::function<bool(Variant&)> callback;
-            const char* module;
-            const char* cmd;
-            const Vector<String> text_values = {};// if specific text values are allowed (can be fixed number values too)
+            const char* module; // interned text of the module name
+            const char* cmd; // interned text of the command name
+            uint16_t module_id;
+            uint16_t cmd_id;
+            const Vector<uint16_t> text_values = {};// ids of specific text values if they are allowed (can be fixed number values too)
             bool allow_numeric_values = false;
-            const Vector<String> numeric_units = {}; // if allow_numeric = true and the value should have units
+            const Vector<uint16_t> numeric_units = {}; // ids of units if allow_numeric = true and the value should have units
+            const LoggerFunctionUnits::Unit* unit_defs = nullptr; // unit table (same order as numeric_units) if values should be normalized
             bool value_optional = false; // whether providing a value is required or optional
             bool expect_value = true; // if either text_values are provided or numeric_values are allowed
             bool use = true; // flag when command is deactivated for some reason
+            bool immediate = false; // executed in the handler even if execution is deferred (built-in commands)
+
+            // rate limiting and coalescing of identical calls
+            RateLimit limit;
+            uint32_t coalesce_ms = 0; // window for coalescing identical calls (0 = no coalescing)
+            uint32_t coalesce_hash = 0; // hash of the value of the last executed call
+            unsigned long coalesce_time = 0; // millis() of the last executed call
 
-            Command(std::function<bool(Variant&)> callback, const char* module, const char* cmd, 
-                const Vector<String>& text_values, bool allow_numeric_values, 
-                const Vector<String>& numeric_units, bool value_optional) : 
-                callback(callback), module(module), cmd(cmd), text_values(text_values), allow_numeric_values(allow_numeric_values), numeric_units(numeric_units), 
-                value_optional(value_optional), expect_value(allow_numeric_values || text_values.size() > 0), use(true) {}
+            // profiling information (fixed size slot per command, times in us, heap in bytes)
+            struct Stats {
+                uint32_t calls = 0;
+                uint32_t executed = 0; // calls that made it to the callback
+                uint32_t rejected = 0; // calls rejected by the rate limit
+                uint32_t coalesced = 0; // calls coalesced with an identical previous call
+                uint32_t parse_us = 0; // cumulative
+                uint32_t parse_max_us = 0;
+                uint32_t exec_us = 0; // cumulative
+                uint32_t exec_max_us = 0;
+                int32_t heap = 0; // cumulative heap retained by the callback (only if heap profiling is on)
+                int32_t heap_max = 0;
+            } stats;
+
+            Command(std::function<bool(Variant&)> callback, uint16_t module_id, uint16_t cmd_id, 
+                const Vector<uint16_t>& text_values, bool allow_numeric_values, 
+                const Vector<uint16_t>& numeric_units, const LoggerFunctionUnits::Unit* unit_defs, bool value_optional) : 
+                callback(callback), module(LoggerFunctionStrings::get(module_id)), cmd(LoggerFunctionStrings::get(cmd_id)), 
+                module_id(module_id), cmd_id(cmd_id), text_values(text_values), allow_numeric_values(allow_numeric_values), numeric_units(numeric_units), 
+                unit_defs(unit_defs), value_optional(value_optional), expect_value(allow_numeric_values || text_values.size() > 0), use(true) {}
 
             /**
              * generate a variant with the command, this is in an optimized JSON format with
              * variables only included when necessary and true/false represented as 1/0
+             * if text_values_idx/numeric_units_idx are provided (>= 0), the values/units are
+             * represented by their index in the catalog dictionary instead of the full list
              */
-            Variant toVariant();
+            Variant toVariant(int text_values_idx = -1, int numeric_units_idx = -1);
         };
 
         // vector of commands        
@@ -74,15 +153,57 @@ class LoggerFunction {
         // it is not a memory problem
         Vector<Command> m_commands;
 
+        // commands catalog: dictionary compressed, split into pages that each fit into the
+        // available commands variable, built once during setup()
+        Vector<String> m_commands_pages; // JSON of each page
+        uint32_t m_commands_hash = 0; // content hash (FNV-1a) of the catalog
+
+        // builds the paginated commands catalog
+        void buildCommandsCatalog();
+
+        // shows a commands catalog page in the available commands variable
+        void showCommandsPage(size_t page);
+
+        // built-in command to select which commands catalog page is shown
+        bool selectCommandsPage(Variant& call);
+
         // register a full cloud command with a std:function call, used by other registerCommmand... calls
+        // unit_defs is the unit table matching numeric_units if values should be normalized
         void registerCommand(const std::function<bool(Variant&)>& cb, const char* module, const char* cmd, 
             const Vector<String>& text_values, bool allow_numeric_values,
-            const Vector<String>& numeric_units, bool value_optional);
+            const Vector<String>& numeric_units, bool value_optional, 
+            const LoggerFunctionUnits::Unit* unit_defs = nullptr);
+
+        // names of the units in a unit table
+        static Vector<String> getUnitNames(const LoggerFunctionUnits::Units& units);
 
         // parses the function call
         // returns the m_commands index of the command that fits the call (or PARSED_ERROR if parsing error)
         size_t parseCall(Variant& parsed);
 
+        // executes the callback of a successfully parsed call and sets the return value
+        void executeCall(size_t cmd_idx, Variant& parsed);
+
+        // checks whether a parsed call is identical to the last accepted one within the command's coalescing window
+        // (returns the hash of the call's value in hash, see setCoalesced())
+        bool isCoalesced(size_t cmd_idx, Variant& parsed, uint32_t& hash);
+
+        // makes an accepted call (executed or queued) the reference for coalescing the following calls
+        void setCoalesced(size_t cmd_idx, uint32_t hash);
+
+        // profiling
+        bool m_profile_heap = false; // whether to measure the heap retained by callbacks (System.freeMemory() is not free)
+        uint32_t m_parse_errors = 0; // number of calls that failed parsing
+
+        // value of the profile variable (computed when the variable is requested)
+        String getProfileJSON();
+
+        // profile from a snapshot of the counters (returned in snapshot, same order as m_commands)
+        Variant getProfile(Vector<Command::Stats>& snapshot);
+
+        // reports a completed call (last calls variable + logging), parsed is moved to the logger if there is one
+        void reportCall(Variant& parsed);
+
     public:
 
         // common text values used a lot
@@ -107,9 +228,77 @@ class LoggerFunction {
 
         /**
          * @brief must be called at the end of setup() to register the cloud function+variables and start listening to commands - note that any registerCommand that is called AFTER setup is not included in the available commands
+         * the available commands variable holds page 0 of the commands catalog, other pages are selected with the
+         * built-in command of the same name as the variable (e.g. 'commands 1'), each page carries the catalog hash ("h")
+         * so clients only need to refetch the pages when the hash changes
+         * the page switch runs in the function handler (never deferred) so the variable shows the page as soon as the call returns,
+         * but the variable is shared by all clients (the last page selected wins), clients must check the page number ("pg")
+         * of the value they read and select their page again if it does not match
+         * the last page(s) of the catalog hold the messages of all registered return codes ("r"), calls only carry the code
          */
         void setup();
 
+        /**
+         * @brief set where the audit records of the calls go if logging is on (e.g. LoggerPublisher::queueCommand)
+         * records are handed over by move (no copy, no re-serialization)
+         * e.g. func->setLogger(publisher, &LoggerPublisher::queueCommand);
+         */
+        template <typename T>
+        // defined here instead of in cpp for full flexibility
+        void setLogger(T* instance, bool (T::*method)(Variant&&)) {
+            m_logger = [instance, method](Variant&& v) {
+                return (instance->*method)(std::move(v));
+            };
+        }
+
+        /**
+         * @brief register a Particle.variable with the per-command profile (see getProfile()), must be called before setup()
+         * heap = true additionally measures the heap retained by each callback (costs two System.freeMemory() calls per call)
+         */
+        void enableProfiling(const char* var_profile = "cmd_profile", bool heap = false) {
+            m_var_profile = var_profile;
+            m_profile_heap = heap;
+        }
+
+        /**
+         * @brief per-command profile: number of parsing errors ("err"), calls rejected by rate limits ("rej") and for each called command ("module cmd")
+         * [calls, avg parse us, max parse us, avg callback us, max callback us, rejected, coalesced] plus [avg heap B, max heap B] if heap profiling is on
+         */
+        Variant getProfile();
+
+        /**
+         * @brief limit how often a command can be called (token bucket with calls_per_sec sustained and up to burst calls at once)
+         * calls beyond the limit are rejected with CALL_ERR_RATE_LIMIT without executing or reporting them (they are only counted)
+         * applies to the command in all modules unless a module is provided, call after registering the command
+         */
+        void setRateLimit(const char* cmd, float calls_per_sec, uint burst = 1, const char* module = nullptr);
+
+        /**
+         * @brief limit how often the function can be called at all (checked before parsing)
+         */
+        void setGlobalRateLimit(float calls_per_sec, uint burst = 1);
+
+        /**
+         * @brief do not execute a value-setting command again if it is called with the same value (and unit) within window_ms
+         * of its last execution, such calls return CALL_COALESCED without executing or reporting them (they are only counted)
+         * applies to the command in all modules unless a module is provided, call after registering the command
+         */
+        void setCoalescing(const char* cmd, uint window_ms, const char* module = nullptr);
+
+        /**
+         * @brief opt-in to deferred execution: calls are still parsed and validated immediately (so the return code is immediate)
+         * but the command callbacks are queued and executed from loop() instead of the Particle.function handler
+         * queue_size is the maximum number of calls that can wait for execution (calls beyond it are rejected),
+         * the default is sized for the platform's RAM at compile time (LoggerPlatformTraits)
+         * must be called before setup(), requires loop() to be called from the global loop
+         */
+        void deferExecution(size_t queue_size = LoggerPlatformTraits::deferred_calls);
+
+        /**
+         * @brief must be called from the global loop if deferExecution() is used, executes the next queued call (if any)
+         */
+        void loop();
+
         /**
          * @brief register a simple cloud command without any value additions
          * usually called during setup
@@ -167,6 +356,26 @@ class LoggerFunction {
             }
         }
 
+        /**
+         * @brief register a cloud command with numeric values in units from a unit table (LoggerFunctionUnits), value required by default
+         * the callback receives the value converted to the canonical unit of the table ("vnorm") and the index of the unit in the table ("uid")
+         * usually called during setup
+         */
+        template <typename T>
+        // defined here instead of in cpp for full flexibility
+        void registerCommandWithNumericValues(T* instance, bool (T::*method)(Variant&), const char* cmd, const LoggerFunctionUnits::Units& units, bool value_optional = false) {
+            std::function<bool(Variant&)> cb = [instance, method](Variant& v) {
+                return (instance->*method)(v);
+            };
+            const Vector<String> empty = {};
+            if constexpr (std::is_convertible_v<T*, LoggerModule*>) {
+                LoggerModule* m = static_cast<LoggerModule*>(instance); 
+                registerCommand(cb, m->getName(), cmd, empty, true, getUnitNames(units), value_optional, units.units);
+            } else {
+                registerCommand(cb, "", cmd, empty, true, getUnitNames(units), value_optional, units.units);
+            }
+        }
+
          /**
          * @brief register a cloud command with mixed test and numeric values, optionally defined units, and value required by default
          * usually called during setup
@@ -185,13 +394,47 @@ class LoggerFunction {
             }
         }
 
+        /**
+         * @brief register a cloud command with mixed text and numeric values in units from a unit table (LoggerFunctionUnits), value required by default
+         * numeric values are normalized like for registerCommandWithNumericValues with a unit table
+         * usually called during setup
+         */
+        template <typename T>
+        // defined here instead of in cpp for full flexibility
+        void registerCommandWithMixedValues(T* instance, bool (T::*method)(Variant&), const char* cmd, const Vector<String>& text_values, const LoggerFunctionUnits::Units& units, bool value_optional = false) {
+            std::function<bool(Variant&)> cb = [instance, method](Variant& v) {
+                return (instance->*method)(v);
+            };
+            if constexpr (std::is_convertible_v<T*, LoggerModule*>) {
+                LoggerModule* m = static_cast<LoggerModule*>(instance); 
+                registerCommand(cb, m->getName(), cmd, text_values, true, getUnitNames(units), value_optional, units.units);
+            } else {
+                registerCommand(cb, "", cmd, text_values, true, getUnitNames(units), value_optional, units.units);
+            }
+        }
+
         /**
          * @brief get back a Variant with all the commands 
-         * this information is stored in a Particle.variable() if var_available_commands is set
+         * this information is stored (dictionary compressed and paginated) in a Particle.variable() if var_available_commands is set
          * it is optimized for minimal JSON (e.g. true/false = 1/0) to accomodate as many commands as possible
          */
         Variant getCommands();
 
+        /**
+         * @brief number of registered commands (including the built-in 'commands' command once setup() ran)
+         */
+        size_t getCommandsCount() { return(m_commands.size()); }
+
+        /**
+         * @brief number of pages of the commands catalog (available after setup())
+         */
+        size_t getCommandsPages() { return(m_commands_pages.size()); }
+
+        /**
+         * @brief content hash of the commands catalog (available after setup())
+         */
+        uint32_t getCommandsHash() { return(m_commands_hash); }
+
         /**
          * @brief internal function that's registered with the Particle cloud to process user commands
          * can be called directly for testing purposes
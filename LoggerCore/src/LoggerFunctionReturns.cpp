@@ -1,6 +1,40 @@
 #include "Particle.h"
 #include "LoggerFunctionReturns.h"
 
+// registry of all known return codes (filled before setup, read-only once locked)
+static Vector<LoggerFunctionReturns::Return> s_return_codes;
+static bool s_return_codes_locked = false;
+
+void LoggerFunctionReturns::registerReturnCode(const Return& ret) {
+    for (size_t i = 0; i < s_return_codes.size(); ++i) {
+        if (s_return_codes[i].code == ret.code) {
+            if (strcmp(s_return_codes[i].message, ret.message) != 0)
+                Log.error("return code %d is used for different messages ('%s' and '%s')", ret.code, s_return_codes[i].message, ret.message);
+            return;
+        }
+    }
+    if (s_return_codes_locked) {
+        Log.error("return code %d (%s) registered after setup(), it is not registered", ret.code, ret.message);
+        return;
+    }
+    s_return_codes.append(ret);
+}
+
+void LoggerFunctionReturns::lockReturnCodes() {
+    s_return_codes_locked = true;
+}
+
+const char* LoggerFunctionReturns::getMessage(int code) {
+    for (size_t i = 0; i < s_return_codes.size(); ++i) {
+        if (s_return_codes[i].code == code) return(s_return_codes[i].message);
+    }
+    return(nullptr);
+}
+
+const Vector<LoggerFunctionReturns::Return>& LoggerFunctionReturns::getReturnCodes() {
+    return(s_return_codes);
+}
+
 bool LoggerFunctionReturns::hasReturnValue(Variant &call) {
     return(call.has("ret"));
 }
@@ -23,8 +57,11 @@ void LoggerFunctionReturns::setReturnValue(Variant& call, int code, const char*
             return;
         }
     }
+    // only the code is stored, the message can be looked up from the code
+    Log.trace("return value %d = %s", code, message);
+    if (getMessage(code) == nullptr)
+        Log.error("return code %d (%s) was not registered before setup(), clients cannot look up its message", code, message);
     call.set("ret", code);
-    call.set("msg", message);
 }
 
 void LoggerFunctionReturns::setReturnValue(Variant& call, LoggerFunctionReturns::Warning warn) {
@@ -8,20 +8,73 @@
  */
 namespace LoggerFunctionReturns {
 
-    struct Error {
+    struct Return {
         const int code;
         const char* message;
-        constexpr Error(int c, const char* msg) : code(c), message(msg) {}
+        constexpr Return(int c, const char* msg) : code(c), message(msg) {}
     };
 
-    struct Warning {
-        const int code;
-        const char* message;
-        constexpr Warning(int c, const char* msg) : code(c), message(msg) {}
+    struct Error : Return {
+        constexpr Error(int c, const char* msg) : Return(c, msg) {}
+    };
+
+    struct Warning : Return {
+        constexpr Warning(int c, const char* msg) : Return(c, msg) {}
     };
 
     const int CMD_SUCCESS =  0;
 
+    /**
+     * @brief compile time check that a list of return codes has no collisions, use in a static_assert
+     */
+    template <size_t N>
+    constexpr bool hasUniqueCodes(const Return (&returns)[N]) {
+        for (size_t i = 0; i < N; ++i)
+            for (size_t j = i + 1; j < N; ++j)
+                if (returns[i].code == returns[j].code) return(false);
+        return(true);
+    }
+
+    /**
+     * @brief compile time check that two lists of return codes have no collisions (neither within nor between them), use in a static_assert
+     */
+    template <size_t N, size_t M>
+    constexpr bool hasUniqueCodes(const Return (&returns)[N], const Return (&others)[M]) {
+        for (size_t i = 0; i < N; ++i)
+            for (size_t j = 0; j < M; ++j)
+                if (returns[i].code == others[j].code) return(false);
+        return(hasUniqueCodes(returns) && hasUniqueCodes(others));
+    }
+
+    /**
+     * @brief register a return code so its message can be looked up later (calls only carry the code)
+     * all codes must be registered before LoggerFunction::setup() (which locks the registry and publishes it in the commands catalog)
+     */
+    void registerReturnCode(const Return& ret);
+
+    /**
+     * @brief register a list of return codes
+     */
+    template <size_t N>
+    void registerReturnCodes(const Return (&returns)[N]) {
+        for (size_t i = 0; i < N; ++i) registerReturnCode(returns[i]);
+    }
+
+    /**
+     * @brief lock the registry (called from LoggerFunction::setup()), it is read-only afterwards so calls can look up codes from any thread
+     */
+    void lockReturnCodes();
+
+    /**
+     * @brief look up the message of a return code (nullptr if the code was never registered)
+     */
+    const char* getMessage(int code);
+
+    /**
+     * @brief all registered return codes
+     */
+    const Vector<Return>& getReturnCodes();
+
      /**
      * @brief check if the call has a return value set
      */
@@ -33,7 +86,8 @@ namespace LoggerFunctionReturns {
     int getReturnValue(Variant &call);
 
     /**
-     * @brief set the return value from code and message
+     * @brief set the return value from code and message - only the code is stored in the call, the message is
+     * logged and can be looked up with getMessage() (logs an error if the code was not registered before setup())
      * (usually not called directly but via void setReturnValue(Variant& call, Warning warn) andvoid setReturnValue(Variant& call, Error err))
      */
     void setReturnValue(Variant& call, int code, const char* message, bool overwrite);
@@ -0,0 +1,46 @@
+#include "Particle.h"
+#include "LoggerFunctionStrings.h"
+
+uint32_t LoggerFunctionStrings::hash(const char* text, size_t length) {
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= (uint8_t) text[i];
+        h *= 16777619UL;
+    }
+    return(h);
+}
+
+uint16_t LoggerFunctionStrings::find(const char* text) {
+    if (text == nullptr) return(NOT_FOUND);
+    size_t length = strlen(text);
+    uint32_t h = hash(text, length);
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        // only compare the strings if hash and length match
+        if (m_entries[i].hash == h && m_entries[i].length == length && strcmp(m_entries[i].text, text) == 0)
+            return(i);
+    }
+    return(NOT_FOUND);
+}
+
+uint16_t LoggerFunctionStrings::intern(const char* text) {
+    if (text == nullptr) text = "";
+    uint16_t id = find(text);
+    if (id != NOT_FOUND) return(id);
+
+    // new string
+    if (m_entries.size() >= NOT_FOUND) {
+        Log.error("cannot intern '%s', string table is full (%d strings)", text, m_entries.size());
+        return(NOT_FOUND);
+    }
+    size_t length = strlen(text);
+    char* copy = new char[length + 1];
+    memcpy(copy, text, length + 1);
+    m_bytes += length + 1;
+    m_entries.append({hash(text, length), length, copy});
+    return(m_entries.size() - 1);
+}
+
+const char* LoggerFunctionStrings::get(uint16_t id) {
+    if (id >= m_entries.size()) return("");
+    return(m_entries[id].text);
+}
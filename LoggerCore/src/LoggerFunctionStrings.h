@@ -0,0 +1,61 @@
+#pragma once
+#include "Particle.h"
+
+/**
+ * @brief append-only table of interned strings (module names, commands, text values and units) that is
+ * shared by all LoggerFunctions - each distinct string is stored only once and referenced by a small integer id,
+ * lookups compare precomputed hashes before comparing the actual strings
+ */
+class LoggerFunctionStrings {
+
+    protected:
+
+        // interned string
+        struct Entry {
+            uint32_t hash;
+            size_t length;
+            const char* text;
+        };
+
+        // table of all interned strings (only grows, usually only during registration in setup())
+        inline static Vector<Entry> m_entries;
+
+        // bytes allocated for the interned strings themselves
+        inline static size_t m_bytes = 0;
+
+    public:
+
+        // id returned for strings that are not in the table
+        static constexpr uint16_t NOT_FOUND = std::numeric_limits<uint16_t>::max();
+
+        /**
+         * @brief FNV-1a hash of text
+         */
+        static uint32_t hash(const char* text, size_t length);
+
+        /**
+         * @brief add text to the table (if it isn't there yet) and return its id
+         */
+        static uint16_t intern(const char* text);
+
+        /**
+         * @brief find the id of text without adding it to the table, returns NOT_FOUND if text was never interned
+         */
+        static uint16_t find(const char* text);
+
+        /**
+         * @brief get back the text of an interned string
+         */
+        static const char* get(uint16_t id);
+
+        /**
+         * @brief number of interned strings
+         */
+        static size_t size() { return(m_entries.size()); }
+
+        /**
+         * @brief approximate heap footprint of the table in bytes (strings + table entries)
+         */
+        static size_t getBytes() { return(m_bytes + m_entries.capacity() * sizeof(Entry)); }
+
+};
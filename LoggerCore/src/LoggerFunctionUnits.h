@@ -0,0 +1,57 @@
+#pragma once
+#include "Particle.h"
+
+/**
+ * @brief namespace that defines unit tables for numeric command values
+ * each unit carries the conversion factor to the canonical unit of its table (the one with factor 1)
+ * so parseCall can hand callbacks an already normalized value ("vnorm") and the index of the unit ("uid")
+ * define additional tables in other classes the same way (including the static_assert)
+ */
+namespace LoggerFunctionUnits {
+
+    struct Unit {
+        const char* name;
+        double factor; // multiply by this to convert to the canonical unit
+        constexpr Unit(const char* n, double f) : name(n), factor(f) {}
+    };
+
+    // constexpr string comparison for compile time checks
+    constexpr bool equal(const char* a, const char* b) {
+        while (*a != '\0' && *a == *b) { ++a; ++b; }
+        return(*a == *b);
+    }
+
+    // index of a unit in a table (e.g. to compare "uid" against), -1 if not in the table
+    template <size_t N>
+    constexpr int indexOf(const std::array<Unit, N>& units, const char* name) {
+        for (size_t i = 0; i < N; ++i)
+            if (equal(units[i].name, name)) return(i);
+        return(-1);
+    }
+
+    // compile time check of a unit table: unique non-empty names, positive factors and a canonical unit
+    template <size_t N>
+    constexpr bool isValid(const std::array<Unit, N>& units) {
+        bool canonical = false;
+        for (size_t i = 0; i < N; ++i) {
+            if (units[i].name == nullptr || units[i].name[0] == '\0' || !(units[i].factor > 0)) return(false);
+            if (units[i].factor == 1.0) canonical = true;
+            for (size_t j = i + 1; j < N; ++j)
+                if (equal(units[i].name, units[j].name)) return(false);
+        }
+        return(canonical);
+    }
+
+    // reference to a unit table (what commands store)
+    struct Units {
+        const Unit* units;
+        size_t size;
+        template <size_t N>
+        constexpr Units(const std::array<Unit, N>& table) : units(table.data()), size(N) {}
+    };
+
+    // time (canonical unit: seconds)
+    inline constexpr std::array<Unit, 4> time = {{ {"ms", 0.001}, {"sec", 1.0}, {"min", 60.0}, {"hr", 3600.0} }};
+    static_assert(isValid(time), "invalid time units");
+
+}
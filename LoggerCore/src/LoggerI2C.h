@@ -0,0 +1,414 @@
+#pragma once
+
+#include "Particle.h"
+#include <mutex>
+#include <deque>
+
+/**
+ * @brief one device on the shared I2C bus
+ * every transaction holds the bus lock (Wire.lock(), recursive) only for itself so transactions of other threads
+ * and devices interleave between them, writes can also be queued and are then sent from LoggerI2C::loop()
+ * (a few per device and loop, round robin) so a large write does not hold up the other devices, a full queue
+ * refuses further writes (back-pressure) until some are sent
+ */
+class LoggerI2CDevice {
+
+    public:
+
+        // one write transaction: register + data (fits into the I2C buffer)
+        struct Transaction {
+            uint8_t reg;
+            uint8_t length;
+            uint8_t data[I2C_BUFFER_LENGTH - 1];
+        };
+
+    private:
+
+        const uint8_t address;
+        const char* name;
+        const uint32_t max_speed; // fastest bus clock the device supports
+
+        // deferred writes
+        std::deque<Transaction> queued;
+        const size_t max_queued; // queued transactions, queue() refuses writes that do not fit
+        bool queue_failed = false; // a queued transaction failed since the last flush()
+
+        // counters
+        uint32_t transactions = 0;
+        uint32_t errors = 0;
+        uint32_t bytes = 0;
+        uint32_t total_us = 0; // bus time
+        uint32_t max_us = 0; // slowest transaction
+
+        bool count(bool success, size_t n, unsigned long start);
+
+    public:
+
+        // registers the device with LoggerI2C
+        LoggerI2CDevice(uint8_t address, const char* name, uint32_t max_speed = CLOCK_SPEED_400KHZ, size_t max_queued = 16);
+        ~LoggerI2CDevice();
+
+        uint8_t getAddress() { return(address); };
+        const char* getName() { return(name); };
+        uint32_t getMaxSpeed() { return(max_speed); };
+
+        // whether the device acknowledged its address when it was last checked (cached, no bus access)
+        bool isPresent();
+
+        // check whether the device acknowledges its address (single address rescan with a short timeout)
+        bool probe();
+
+        // one write transaction: register followed by data (at most I2C_BUFFER_LENGTH bytes in total)
+        bool write(uint8_t reg, const uint8_t* data = nullptr, size_t length = 0);
+
+        // one read transaction (at most I2C_BUFFER_LENGTH bytes), returns the number of bytes read
+        size_t read(uint8_t* data, size_t length);
+
+        // queue a write of any length to the register (split into transactions, a register-only write with no data
+        // is a single transaction, no bus access), returns false and
+        // queues nothing if the queue has no room for all of them (send some first, e.g. flush()),
+        // failed queued transactions are reported by flush()
+        bool queue(uint8_t reg, const uint8_t* data, size_t length);
+
+        // send the oldest queued transaction, returns false if there was none
+        bool sendQueued();
+
+        // send all queued transactions, returns false if any queued transaction failed since the last flush()
+        bool flush();
+
+        size_t getQueued() { return(queued.size()); };
+
+        /**
+         * @brief transaction counters, e.g. {"n": 1024, "err": 0, "B": 30720, "us": 2750, "max_us": 3100, "q": 0}
+         * with us the average bus time per transaction
+         */
+        Variant getCounters();
+        void resetCounters();
+};
+
+/**
+ * @brief shared I2C bus: starts the bus once, manages the clock (never faster than the slowest registered device),
+ * and sends the devices' queued writes from loop()
+ */
+namespace LoggerI2C {
+
+    // registered devices
+    inline Vector<LoggerI2CDevice*>& getDevices();
+    inline void add(LoggerI2CDevice* device);
+    inline void remove(LoggerI2CDevice* device);
+
+    // start the bus (once)
+    inline void begin();
+
+    // bus clock
+    inline uint32_t clock_speed = CLOCK_SPEED_100KHZ;
+    inline uint32_t getMaxClockSpeed(); // slowest registered device
+
+    /**
+     * @brief switch the bus clock (limited to getMaxClockSpeed()) if every device that responds at the current clock
+     * still responds at the new one, returns whether the bus runs at the requested speed
+     */
+    inline bool setClockSpeed(uint32_t speed);
+
+    // bitmask of the addresses that respond (each address is probed with probe_timeout)
+    inline void scan(uint32_t (&found)[4]);
+
+    // device discovery: the bus is scanned once (discover(), call it from setup(), a scan probes 126 addresses) and the
+    // map of the addresses that respond is cached, afterwards only single addresses are rescanned (on demand or from
+    // loop() after a failed transaction)
+    inline uint32_t device_map[4] = {0, 0, 0, 0}; // bitmask of the addresses that responded
+    inline uint32_t rescan_map[4] = {0, 0, 0, 0}; // bitmask of the addresses to rescan from loop()
+    inline bool discovered = false;
+    inline system_tick_t probe_timeout = 5; // ms per address
+
+    // scan the whole bus (only the first time unless forced)
+    inline void discover(bool force = false);
+
+    // whether the address responded (cached map only, no bus access: false until discover() or rescan() found it)
+    inline bool isPresent(uint8_t address);
+
+    // probe a single address and update the map, returns whether it responds
+    inline bool rescan(uint8_t address);
+
+    // rescan the address from loop()
+    inline void requestRescan(uint8_t address);
+
+    // addresses in the map, e.g. ["0x2A", "0x3C"]
+    inline VariantArray getDeviceMap();
+
+    // queued writes: transactions sent per loop() (spread across devices round robin)
+    inline size_t loop_budget = 8;
+    inline size_t loop_next = 0; // device to start with in the next loop()
+
+    // must be called from the global loop (LoggerPlatform::loop() does)
+    inline void loop();
+
+    /**
+     * @brief clock speed, device map and per device counters (by name), e.g. {"kHz": 400, "map": ["0x2A", "0x3C"], "sd": {...}}
+     */
+    inline Variant getStatus();
+}
+
+/*** implementation ***/
+
+// device
+inline LoggerI2CDevice::LoggerI2CDevice(uint8_t address, const char* name, uint32_t max_speed, size_t max_queued) :
+    address(address), name(name), max_speed(max_speed), max_queued(max_queued) {
+    LoggerI2C::add(this);
+}
+
+inline LoggerI2CDevice::~LoggerI2CDevice() {
+    LoggerI2C::remove(this);
+}
+
+inline bool LoggerI2CDevice::count(bool success, size_t n, unsigned long start) {
+    unsigned long us = micros() - start;
+    transactions++;
+    total_us += us;
+    if (us > max_us) max_us = us;
+    if (success) {
+        bytes += n;
+    } else {
+        errors++;
+        // check from loop() whether the device is still there
+        LoggerI2C::requestRescan(address);
+    }
+    return(success);
+}
+
+inline bool LoggerI2CDevice::isPresent() {
+    return(LoggerI2C::isPresent(address));
+}
+
+inline bool LoggerI2CDevice::probe() {
+    unsigned long start = micros();
+    bool found = LoggerI2C::rescan(address);
+    transactions++;
+    total_us += micros() - start;
+    return(found);
+}
+
+inline bool LoggerI2CDevice::write(uint8_t reg, const uint8_t* data, size_t length) {
+    std::lock_guard<TwoWire> lock(Wire);
+    unsigned long start = micros();
+    Wire.beginTransmission(address);
+    Wire.write(reg);
+    if (length > 0) Wire.write(data, length);
+    return(count(Wire.endTransmission() == 0, 1 + length, start));
+}
+
+inline size_t LoggerI2CDevice::read(uint8_t* data, size_t length) {
+    std::lock_guard<TwoWire> lock(Wire);
+    unsigned long start = micros();
+    size_t n = std::min(length, (size_t) I2C_BUFFER_LENGTH);
+    size_t received = Wire.requestFrom(address, n);
+    size_t i = 0;
+    while (Wire.available() && i < received) data[i++] = Wire.read();
+    count(i == n, i, start);
+    return(i);
+}
+
+inline bool LoggerI2CDevice::queue(uint8_t reg, const uint8_t* data, size_t length) {
+    // the lock only guards the queue here (no bus access)
+    std::lock_guard<TwoWire> lock(Wire);
+    const size_t chunk = sizeof(Transaction::data);
+    // a register-only write (no data) is one transaction too
+    size_t n = std::max((length + chunk - 1) / chunk, (size_t) 1);
+    if (queued.size() + n > max_queued) return(false);
+    for (size_t i = 0; i < n; i++) {
+        Transaction transaction;
+        transaction.reg = reg;
+        transaction.length = std::min(chunk, length - i * chunk);
+        if (transaction.length > 0) memcpy(transaction.data, data + i * chunk, transaction.length);
+        queued.push_back(transaction);
+    }
+    return(true);
+}
+
+inline bool LoggerI2CDevice::sendQueued() {
+    // locked for this one transaction (so the queue is sent in order)
+    std::lock_guard<TwoWire> lock(Wire);
+    if (queued.empty()) return(false);
+    const Transaction& transaction = queued.front();
+    if (!write(transaction.reg, transaction.data, transaction.length)) queue_failed = true;
+    queued.pop_front();
+    return(true);
+}
+
+inline bool LoggerI2CDevice::flush() {
+    // one transaction at a time, other threads and devices get the bus in between
+    while (sendQueued());
+    std::lock_guard<TwoWire> lock(Wire);
+    bool success = !queue_failed;
+    queue_failed = false;
+    return(success);
+}
+
+inline Variant LoggerI2CDevice::getCounters() {
+    Variant counters;
+    counters.set("n", transactions);
+    counters.set("err", errors);
+    counters.set("B", bytes);
+    counters.set("us", transactions > 0 ? total_us / transactions : 0);
+    counters.set("max_us", max_us);
+    counters.set("q", (int) queued.size());
+    return(counters);
+}
+
+inline void LoggerI2CDevice::resetCounters() {
+    transactions = 0;
+    errors = 0;
+    bytes = 0;
+    total_us = 0;
+    max_us = 0;
+}
+
+// bus
+Vector<LoggerI2CDevice*>& LoggerI2C::getDevices() {
+    // function local so devices constructed during static initialization can register
+    static Vector<LoggerI2CDevice*> devices;
+    return(devices);
+}
+
+void LoggerI2C::add(LoggerI2CDevice* device) {
+    // no bus lock: devices are usually constructed during static initialization (before threads are running)
+    getDevices().append(device);
+}
+
+void LoggerI2C::remove(LoggerI2CDevice* device) {
+    std::lock_guard<TwoWire> lock(Wire);
+    int i = getDevices().indexOf(device);
+    if (i >= 0) getDevices().removeAt(i);
+}
+
+void LoggerI2C::begin() {
+    std::lock_guard<TwoWire> lock(Wire);
+    if (!Wire.isEnabled()) {
+        Wire.setSpeed(clock_speed);
+        Wire.begin();
+    }
+}
+
+uint32_t LoggerI2C::getMaxClockSpeed() {
+    uint32_t speed = CLOCK_SPEED_400KHZ;
+    for (LoggerI2CDevice* device : getDevices()) speed = std::min(speed, device->getMaxSpeed());
+    return(speed);
+}
+
+void LoggerI2C::scan(uint32_t (&found)[4]) {
+    begin();
+    for (size_t i = 0; i < 4; i++) found[i] = 0;
+    for (uint8_t address = 1; address < 127; address++) {
+        // lock per address so other transactions are not held up by the whole scan
+        std::lock_guard<TwoWire> lock(Wire);
+        Wire.beginTransmission(WireTransmission(address).timeout(probe_timeout));
+        if (Wire.endTransmission() == 0) found[address / 32] |= (1UL << (address % 32));
+    }
+}
+
+// discovery
+void LoggerI2C::discover(bool force) {
+    if (discovered && !force) return;
+    unsigned long start = millis();
+    scan(device_map);
+    for (size_t i = 0; i < 4; i++) rescan_map[i] = 0;
+    discovered = true;
+    Log.info("I2C bus scanned in %lu ms, %d devices found", millis() - start, getDeviceMap().size());
+}
+
+bool LoggerI2C::isPresent(uint8_t address) {
+    return(device_map[address / 32] & (1UL << (address % 32)));
+}
+
+bool LoggerI2C::rescan(uint8_t address) {
+    begin();
+    std::lock_guard<TwoWire> lock(Wire);
+    Wire.beginTransmission(WireTransmission(address).timeout(probe_timeout));
+    bool found = (Wire.endTransmission() == 0);
+    uint32_t bit = 1UL << (address % 32);
+    if (found) device_map[address / 32] |= bit;
+    else device_map[address / 32] &= ~bit;
+    rescan_map[address / 32] &= ~bit;
+    return(found);
+}
+
+void LoggerI2C::requestRescan(uint8_t address) {
+    rescan_map[address / 32] |= (1UL << (address % 32));
+}
+
+VariantArray LoggerI2C::getDeviceMap() {
+    VariantArray map;
+    for (uint8_t address = 1; address < 127; address++) {
+        if (device_map[address / 32] & (1UL << (address % 32))) map.append(String::format("0x%02X", address));
+    }
+    return(map);
+}
+
+bool LoggerI2C::setClockSpeed(uint32_t speed) {
+    uint32_t requested = speed;
+    speed = std::min(speed, getMaxClockSpeed());
+    if (speed != clock_speed) {
+        uint32_t previous_speed = clock_speed;
+        // locked only while the bus restarts, the scans lock per address (like any other scan)
+        auto apply = [](uint32_t speed) {
+            std::lock_guard<TwoWire> lock(Wire);
+            Wire.end();
+            Wire.setSpeed(speed);
+            Wire.begin();
+            clock_speed = speed;
+        };
+
+        // same devices at the new speed?
+        uint32_t before[4], after[4];
+        scan(before);
+        apply(speed);
+        scan(after);
+        bool same = true;
+        for (size_t i = 0; i < 4; i++) same = same && (before[i] == after[i]);
+        if (!same) {
+            Log.warn("not all I2C devices respond at %lu kHz, staying at %lu kHz", speed / 1000, previous_speed / 1000);
+            apply(previous_speed);
+        } else {
+            Log.info("I2C bus switched to %lu kHz", speed / 1000);
+            for (size_t i = 0; i < 4; i++) device_map[i] = after[i];
+            discovered = true;
+        }
+    }
+    return(clock_speed == requested);
+}
+
+void LoggerI2C::loop() {
+    // rescan one address after a failed transaction
+    for (uint8_t address = 1; address < 127; address++) {
+        if (rescan_map[address / 32] & (1UL << (address % 32))) {
+            if (!rescan(address)) Log.warn("I2C device at 0x%02X stopped responding", address);
+            break;
+        }
+    }
+
+    // queued writes
+    Vector<LoggerI2CDevice*>& devices = getDevices();
+    size_t sent = 0, idle = 0;
+    // one transaction per device with queued writes in turn until the budget is used up or nothing is queued
+    while (sent < loop_budget && devices.size() > 0 && idle < (size_t) devices.size()) {
+        // locked per transaction so other threads get the bus in between
+        std::lock_guard<TwoWire> lock(Wire);
+        loop_next = loop_next % devices.size();
+        if (devices[loop_next]->sendQueued()) {
+            sent++;
+            idle = 0;
+        } else {
+            idle++;
+        }
+        loop_next++;
+    }
+}
+
+Variant LoggerI2C::getStatus() {
+    std::lock_guard<TwoWire> lock(Wire);
+    Variant status;
+    status.set("kHz", clock_speed / 1000);
+    if (discovered) status.set("map", getDeviceMap());
+    for (LoggerI2CDevice* device : getDevices()) status.set(device->getName(), device->getCounters());
+    return(status);
+}
@@ -1,11 +1,8 @@
 #pragma once
 
 #include "Particle.h"
-
-// address issue where this is not defined anymore in newer firmware
-#ifndef PLATFORM_PHOTON 
-#define PLATFORM_PHOTON 0 
-#endif
+#include "LoggerPlatformTraits.h"
+#include "LoggerI2C.h"
 
 // file helper to get at flash system usage
 // dependencies.FileHelperRK=0.0.3
@@ -13,60 +10,162 @@
 
 namespace LoggerPlatform {
 
+    // compile time traits of this platform
+    using Traits = LoggerPlatformTraits::Current;
+
     // wifi
-    #if (PLATFORM_ID == PLATFORM_PHOTON || PLATFORM_ID == PLATFORM_ARGON || PLATFORM_ID == PLATFORM_P2)
-    const bool wifi = true;
-    #else
-    const bool wifi = false;
-    #endif
-    const bool hasWifi() { return wifi; };
+    const bool wifi = Traits::wifi;
+    inline const bool hasWifi() { return wifi; };
 
     // cellular
-    #if (PLATFORM_ID == PLATFORM_BORON)
-    const bool cellular = true;
-    #else
-    const bool cellular = false;
-    #endif
-    const bool hasCellular() { return cellular; };
+    const bool cellular = Traits::cellular;
+    inline const bool hasCellular() { return cellular; };
 
     // byte size constants
-    const size_t B = 1;
-    const size_t KB = 1024;
-    const size_t MB = 1024 * 1024;
+    const size_t B = LoggerPlatformTraits::B;
+    const size_t KB = LoggerPlatformTraits::KB;
+    const size_t MB = LoggerPlatformTraits::MB;
 
     // flash memory (in bytes)
-    #if (PLATFORM_ID == PLATFORM_ARGON || PLATFORM_ID == PLATFORM_P2 || PLATFORM_ID == PLATFORM_BORON)
-    const size_t flash_size = 2 * MB;
-    #else
-    const size_t flash_size = 0;
-    #endif
-    const bool hasFlash() { return (flash_size > 0); };
-    const float getTotalFlash(const size_t units = B);
-    float getUsedFlash(const size_t units = B);
-    float getFreeFlash(const size_t units = B);
-    float getFreeFlashPercent();
+    const size_t flash_size = Traits::flash_size;
+    inline const bool hasFlash() { return (flash_size > 0); };
+    inline const float getTotalFlash(const size_t units = B);
+    inline float getUsedFlash(const size_t units = B);
+    inline float getFreeFlash(const size_t units = B);
+    inline float getFreeFlashPercent();
 
     // flash sectors
-    const size_t sector_size = 4 * KB;
+    const size_t sector_size = Traits::sector_size;
     const size_t flash_sectors = flash_size / sector_size; // available sectors
 
+    // flash usage tracking: walking the file system (FileHelperRK::Usage) is expensive so the usage is measured once,
+    // then updated incrementally by the library's own file writes/deletes (LoggerStorage, LoggerSDEmulator) and
+    // reconciled periodically in loop(), files written by other libraries (e.g. the PublishQueueExtRK queue) are only
+    // picked up by the reconciliation, so the cached usage can be up to flash_reconcile_interval stale
+    inline size_t flash_used_sectors = 0; // cached number of used sectors
+    inline bool flash_measured = false; // whether the file system has been measured yet
+    inline unsigned long flash_last_measured = 0; // millis() of the last measurement
+    inline unsigned long flash_reconcile_interval = 10 * 60 * 1000; // ms between reconciliations (0 = never)
+    inline void measureFlash(); // walk the file system to (re)measure the usage
+    inline void trackFlashWrite(const size_t size_before, const size_t size_after); // call after the library changes a file's size
+    inline void trackFlashDelete(const size_t size); // call after the library deletes a file
+
     // random access memory / RAM (in bytes) that is available to the user application
-    #if (PLATFORM_ID == PLATFORM_PHOTON)
-    const size_t ram_size = 60 * KB; // approximate
-    #elif (PLATFORM_ID == PLATFORM_ARGON || PLATFORM_ID == PLATFORM_BORON)
-    const size_t ram_size = 80 * KB; // approximate
-    #elif (PLATFORM_ID == PLATFORM_P2)
-    const size_t ram_size = 3 * MB; // approximate
-    #else
-    const size_t ram_size = 0;
-    #endif
-    const float getTotalRAM(const size_t units = B);
-    float getUsedRAM(const size_t units = B);
-    float getFreeRAM(const size_t units = B);
-    float getFreeRAMPercent();
+    const size_t ram_size = Traits::ram_size; // approximate
+    inline const float getTotalRAM(const size_t units = B);
+    inline float getUsedRAM(const size_t units = B);
+    inline float getFreeRAM(const size_t units = B);
+    inline float getFreeRAMPercent();
+
+    // heap monitoring: out of memory failures usually come from fragmentation (no block large enough) rather than
+    // total exhaustion so the largest allocatable block is sampled alongside the free heap into a fixed ring buffer
+    struct HeapSample {
+        unsigned long time = 0; // millis()
+        uint32_t free = 0; // bytes of free heap
+        uint32_t largest = 0; // bytes in the largest free block
+    };
+    const size_t heap_samples_size = 32; // ring buffer size (with the default interval: ~2.5 min of history)
+    inline HeapSample heap_samples[heap_samples_size];
+    inline size_t heap_samples_first = 0; // index of the oldest sample
+    inline size_t heap_samples_n = 0; // number of samples in the buffer
+    inline uint32_t heap_low_water = UINT32_MAX; // lowest largest free block seen (bytes)
+    inline unsigned long heap_sample_interval = 5000; // ms between samples in loop() (0 = never)
+    inline unsigned long heap_last_sampled = 0; // millis() of the last sample
+    inline HeapSample sampleHeap(); // sample now and add to the ring buffer
+    inline uint32_t getSampledFreeHeap(); // free heap of the latest sample (cheap enough to check in every loop())
+    inline float getHeapFragmentation(); // 0 (one contiguous block) to 1 (fully fragmented), from the latest sample
+    inline float getSecondsToHeapExhaustion(); // linear trend of the largest block down to the reserve, NAN if not shrinking
+
+    // low memory callback: triggered from loop() once when the largest free block drops below the reserve
+    // or exhaustion is forecast within the horizon (re-armed when the condition clears) so the application
+    // can shed load before the out_of_memory handler has to reset the device
+    inline uint32_t heap_reserve = 0; // bytes
+    inline float heap_horizon = 0; // seconds
+    inline bool heap_low = false; // whether the callback was triggered (and not yet re-armed)
+    inline std::function<void(const HeapSample&, float)> heap_low_callback = nullptr;
+    inline void onLowMemory(std::function<void(const HeapSample&, float)> callback, const uint32_t reserve = 10 * KB, const float horizon = 60);
+
+    // thread stacks: the RTOS paints every stack when the thread is created, the high water mark is
+    // the least free stack seen so far (scanned periodically from loop(), the scan briefly suspends the scheduler)
+    struct StackSample {
+        char name[16] = ""; // thread name
+        uint32_t free = 0; // bytes of stack that were never used
+        bool warned = false; // whether the low stack warning was logged for this thread
+    };
+    const size_t stack_threads_max = 16; // threads beyond this are not tracked
+    inline StackSample stack_samples[stack_threads_max];
+    inline size_t stack_threads_n = 0; // number of threads found in the last scan
+    inline unsigned long stack_sample_interval = 60000; // ms between scans in loop() (0 = never)
+    inline unsigned long stack_last_sampled = 0; // millis() of the last scan
+    inline uint32_t stack_warn_bytes = 256; // warn when a thread's free stack drops below this
+    inline size_t sampleStacks(); // scan all threads (returns the number of threads, 0 without threading)
+    inline Variant getStackProfile(); // {"thread name": free bytes}
+
+    // loop profiler: histogram of the period between loop() calls in log2 microsecond buckets
+    // (bucket i counts periods of 2^i to 2^(i+1)-1 us, the last bucket also everything longer)
+    // costs one micros() and one bucket increment per loop()
+    const size_t loop_buckets = 24; // up to ~16 s
+    inline uint32_t loop_histogram[loop_buckets] = {};
+    inline unsigned long loop_last_us = 0; // micros() of the last loop()
+    inline uint32_t loop_max_us = 0; // longest period (worst stall)
+    inline const char* loop_max_section = nullptr; // longest running section during the worst stall
+    inline const char* loop_section = nullptr; // longest running section since the last loop()
+    inline uint32_t loop_section_us = 0; // its duration
+    inline uint32_t loop_nested_us = 0; // time spent in nested sections of the running section
+    inline void resetLoopProfile();
+    inline Variant getLoopProfile(); // {"hist": [counts from bucket 0], "max": us, "stall": section}
+
+    // scoped marker to attribute stalls to a named section, e.g. { LoggerPlatform::ProfileSection section("sd"); ... }
+    // sections can be nested, each is attributed its own time (without the time of its nested sections)
+    class ProfileSection {
+        private:
+            const char* m_name;
+            const unsigned long m_start;
+            const uint32_t m_outer_nested_us; // nested time of the enclosing section so far
+        public:
+            ProfileSection(const char* name) : m_name(name), m_start(micros()), m_outer_nested_us(loop_nested_us) {
+                loop_nested_us = 0;
+            }
+            ~ProfileSection() {
+                uint32_t us = micros() - m_start;
+                uint32_t own_us = us - loop_nested_us;
+                loop_nested_us = m_outer_nested_us + us;
+                if (own_us > loop_section_us) {
+                    loop_section_us = own_us;
+                    loop_section = m_name;
+                }
+            }
+    };
 
     // info
-    Variant getSystemStatus();
+    inline Variant getSystemStatus();
+
+    // fixed layout snapshot of the changing parts of the system status (cheap to sample, no allocations)
+    struct StatusSnapshot {
+        uint32_t ram_used = 0; // bytes
+        uint32_t flash_used = 0; // bytes
+        bool connected = false; // cloud connection
+    };
+    inline StatusSnapshot sampleStatus();
+
+    // status reports that only include the fields that changed (beyond a threshold) since the last report
+    // plus a full keyframe (getSystemStatus() with "kf":1) every keyframe_every reports (0 = only the first report)
+    class StatusReporter {
+        private:
+            StatusSnapshot m_last; // last reported values
+            uint32_t m_reports = 0; // number of reports so far
+            const uint32_t m_keyframe_every; // reports between full keyframes
+            const uint32_t m_ram_threshold; // bytes of RAM change to report
+            const uint32_t m_flash_threshold; // bytes of flash change to report
+        public:
+            StatusReporter(const uint32_t keyframe_every = 12, const uint32_t ram_threshold = KB, const uint32_t flash_threshold = sector_size) : 
+                m_keyframe_every(keyframe_every), m_ram_threshold(ram_threshold), m_flash_threshold(flash_threshold) {}
+            // next report (empty if nothing changed), the first report is always a keyframe
+            inline Variant report();
+    };
+
+    // must be called from the global loop (loop profiling and periodic background tasks like the flash usage reconciliation)
+    inline void loop();
 
 }
 
@@ -78,9 +177,8 @@ const float LoggerPlatform::getTotalFlash(const size_t units) {
 }
 float LoggerPlatform::getUsedFlash(const size_t units) { 
     if (!hasFlash()) return (0.0);
-    FileHelperRK::Usage usage;
-    usage.measure("/");
-    return( (float) (usage.sectors * sector_size) / units);
+    if (!flash_measured) measureFlash();
+    return( (float) (flash_used_sectors * sector_size) / units);
 }
 float LoggerPlatform::getFreeFlash(const size_t units) { 
     if (!hasFlash()) return (0.0);
@@ -91,6 +189,35 @@ float LoggerPlatform::getFreeFlashPercent() {
     return(100. * getFreeFlash() / getTotalFlash()); 
 };
 
+// flash usage tracking
+void LoggerPlatform::measureFlash() {
+    if (!hasFlash()) return;
+    unsigned long start = millis();
+    FileHelperRK::Usage usage;
+    usage.measure("/");
+    if (flash_measured && usage.sectors != flash_used_sectors) {
+        Log.trace("flash usage reconciled from %d to %d sectors", flash_used_sectors, usage.sectors);
+    }
+    flash_used_sectors = usage.sectors;
+    flash_measured = true;
+    flash_last_measured = millis();
+    Log.trace("measured flash usage (%d sectors) in %lu ms", flash_used_sectors, flash_last_measured - start);
+}
+void LoggerPlatform::trackFlashWrite(const size_t size_before, const size_t size_after) {
+    if (!flash_measured) return; // will be measured on first use
+    size_t sectors_before = (size_before + sector_size - 1) / sector_size;
+    size_t sectors_after = (size_after + sector_size - 1) / sector_size;
+    if (sectors_after >= sectors_before) {
+        flash_used_sectors += sectors_after - sectors_before;
+    } else {
+        size_t freed = sectors_before - sectors_after;
+        flash_used_sectors = (freed < flash_used_sectors) ? flash_used_sectors - freed : 0;
+    }
+}
+void LoggerPlatform::trackFlashDelete(const size_t size) {
+    trackFlashWrite(size, 0);
+}
+
 // RAM functions
 const float LoggerPlatform::getTotalRAM(const size_t units) { 
     return( (float) ram_size/units); 
@@ -105,6 +232,64 @@ float LoggerPlatform::getFreeRAMPercent() {
     return(100. * getFreeRAM() / getTotalRAM()); 
 };
 
+// heap monitoring
+LoggerPlatform::HeapSample LoggerPlatform::sampleHeap() {
+    runtime_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.size = sizeof(info);
+    HAL_Core_Runtime_Info(&info, nullptr);
+    HeapSample sample;
+    sample.time = millis();
+    sample.free = info.freeheap;
+    sample.largest = info.largest_free_block_heap;
+    if (sample.largest < heap_low_water) heap_low_water = sample.largest;
+    // ring buffer (overwrites the oldest sample when full)
+    heap_samples[(heap_samples_first + heap_samples_n) % heap_samples_size] = sample;
+    if (heap_samples_n < heap_samples_size) heap_samples_n++;
+    else heap_samples_first = (heap_samples_first + 1) % heap_samples_size;
+    heap_last_sampled = sample.time;
+    return(sample);
+}
+
+uint32_t LoggerPlatform::getSampledFreeHeap() {
+    if (heap_samples_n == 0) sampleHeap();
+    return(heap_samples[(heap_samples_first + heap_samples_n - 1) % heap_samples_size].free);
+}
+
+float LoggerPlatform::getHeapFragmentation() {
+    if (heap_samples_n == 0) sampleHeap();
+    const HeapSample& last = heap_samples[(heap_samples_first + heap_samples_n - 1) % heap_samples_size];
+    if (last.free == 0) return(NAN);
+    return(1.0f - (float) last.largest / last.free);
+}
+
+float LoggerPlatform::getSecondsToHeapExhaustion() {
+    if (heap_samples_n < 2) return(NAN);
+    // least squares slope of the largest block (bytes/s), times relative to the oldest sample
+    const HeapSample& first = heap_samples[heap_samples_first];
+    float n = heap_samples_n, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < heap_samples_n; i++) {
+        const HeapSample& s = heap_samples[(heap_samples_first + i) % heap_samples_size];
+        float x = (s.time - first.time) / 1000.0f;
+        float y = s.largest;
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
+    }
+    float denom = n * sxx - sx * sx;
+    if (denom <= 0) return(NAN);
+    float slope = (n * sxy - sx * sy) / denom;
+    if (slope >= 0) return(NAN);
+    const HeapSample& last = heap_samples[(heap_samples_first + heap_samples_n - 1) % heap_samples_size];
+    if (last.largest <= heap_reserve) return(0);
+    return((last.largest - heap_reserve) / -slope);
+}
+
+void LoggerPlatform::onLowMemory(std::function<void(const HeapSample&, float)> callback, const uint32_t reserve, const float horizon) {
+    heap_low_callback = callback;
+    heap_reserve = reserve;
+    heap_horizon = horizon;
+    heap_low = false;
+}
+
 // system status
 Variant LoggerPlatform::getSystemStatus() {
     Variant sys;
@@ -115,10 +300,178 @@ Variant LoggerPlatform::getSystemStatus() {
     Variant mem;
     mem.set("total", getTotalRAM());
     mem.set("used", getUsedRAM());
+    mem.set("frag", getHeapFragmentation());
+    mem.set("low", heap_low_water);
     sys.set("RAM", mem);
     Variant flash;
     flash.set("total", getTotalFlash());
     flash.set("used", getUsedFlash());
     sys.set("flash", flash);
+    sys.set("loop", getLoopProfile());
+    if (stack_threads_n > 0) sys.set("stack", getStackProfile());
+    if (LoggerI2C::discovered || LoggerI2C::getDevices().size() > 0) sys.set("i2c", LoggerI2C::getStatus());
     return(sys);
+}
+
+// status snapshots
+LoggerPlatform::StatusSnapshot LoggerPlatform::sampleStatus() {
+    StatusSnapshot snapshot;
+    snapshot.ram_used = (uint32_t) getUsedRAM();
+    snapshot.flash_used = (uint32_t) getUsedFlash();
+    snapshot.connected = Particle.connected();
+    return(snapshot);
+}
+
+Variant LoggerPlatform::StatusReporter::report() {
+    StatusSnapshot now = sampleStatus();
+    Variant status;
+
+    // full keyframe
+    if (m_reports == 0 || (m_keyframe_every > 0 && m_reports % m_keyframe_every == 0)) {
+        m_reports++;
+        status = getSystemStatus();
+        status.set("cloud", now.connected);
+        status.set("kf", 1);
+        m_last = now;
+        return(status);
+    }
+
+    // changes only
+    m_reports++;
+    auto changed = [](uint32_t a, uint32_t b, uint32_t threshold) { 
+        return((a > b ? a - b : b - a) >= threshold); 
+    };
+    if (changed(now.ram_used, m_last.ram_used, m_ram_threshold)) {
+        Variant mem;
+        mem.set("used", now.ram_used);
+        status.set("RAM", mem);
+        m_last.ram_used = now.ram_used;
+    }
+    if (changed(now.flash_used, m_last.flash_used, m_flash_threshold)) {
+        Variant flash;
+        flash.set("used", now.flash_used);
+        status.set("flash", flash);
+        m_last.flash_used = now.flash_used;
+    }
+    if (now.connected != m_last.connected) {
+        status.set("cloud", now.connected);
+        m_last.connected = now.connected;
+    }
+    return(status);
+}
+
+// thread stacks
+size_t LoggerPlatform::sampleStacks() {
+    #if PLATFORM_THREADING
+    stack_threads_n = 0;
+    os_thread_dump(OS_THREAD_INVALID_HANDLE, [](os_thread_dump_info_t* info, void* data) -> os_result_t {
+        if (stack_threads_n >= stack_threads_max) return(0);
+        StackSample& sample = stack_samples[stack_threads_n++];
+        // keep the warning state if the same thread is still in this slot
+        if (strncmp(sample.name, info->name ? info->name : "", sizeof(sample.name) - 1) != 0) {
+            strncpy(sample.name, info->name ? info->name : "", sizeof(sample.name) - 1);
+            sample.name[sizeof(sample.name) - 1] = '\0';
+            sample.warned = false;
+        }
+        // the high water mark is in stack words (32 bit on all supported platforms)
+        sample.free = info->stack_high_watermark * sizeof(uint32_t);
+        return(0);
+    }, nullptr);
+    stack_last_sampled = millis();
+    for (size_t i = 0; i < stack_threads_n; i++) {
+        StackSample& sample = stack_samples[i];
+        if (sample.free < stack_warn_bytes && !sample.warned) {
+            Log.warn("thread '%s' is close to its stack limit (%lu bytes never used)", sample.name, sample.free);
+            sample.warned = true;
+        }
+    }
+    return(stack_threads_n);
+    #else
+    return(0);
+    #endif
+}
+
+Variant LoggerPlatform::getStackProfile() {
+    Variant stacks;
+    for (size_t i = 0; i < stack_threads_n; i++) {
+        stacks.set(stack_samples[i].name, stack_samples[i].free);
+    }
+    return(stacks);
+}
+
+// loop profiler
+void LoggerPlatform::resetLoopProfile() {
+    for (size_t i = 0; i < loop_buckets; i++) loop_histogram[i] = 0;
+    loop_last_us = 0;
+    loop_max_us = 0;
+    loop_max_section = nullptr;
+    loop_section = nullptr;
+    loop_section_us = 0;
+    loop_nested_us = 0;
+}
+
+Variant LoggerPlatform::getLoopProfile() {
+    Variant profile;
+    VariantArray hist;
+    size_t last = 0;
+    for (size_t i = 0; i < loop_buckets; i++) {
+        if (loop_histogram[i] > 0) last = i + 1;
+    }
+    for (size_t i = 0; i < last; i++) {
+        hist.append(loop_histogram[i]);
+    }
+    profile.set("hist", hist);
+    profile.set("max", loop_max_us);
+    if (loop_max_section != nullptr) profile.set("stall", loop_max_section);
+    return(profile);
+}
+
+// background tasks
+void LoggerPlatform::loop() {
+    // loop period
+    unsigned long now = micros();
+    if (loop_last_us > 0) {
+        uint32_t period = now - loop_last_us;
+        size_t bucket = period > 0 ? 31 - __builtin_clz(period) : 0;
+        loop_histogram[bucket < loop_buckets ? bucket : loop_buckets - 1]++;
+        if (period > loop_max_us) {
+            loop_max_us = period;
+            loop_max_section = loop_section;
+        }
+    }
+    loop_last_us = now;
+    loop_section = nullptr;
+    loop_section_us = 0;
+    loop_nested_us = 0;
+
+    // reconcile the tracked flash usage with the file system
+    if (flash_measured && flash_reconcile_interval > 0 && millis() - flash_last_measured > flash_reconcile_interval) {
+        ProfileSection section("flash");
+        measureFlash();
+    }
+    // sample the heap and check for low memory
+    if (heap_sample_interval > 0 && (heap_samples_n == 0 || millis() - heap_last_sampled > heap_sample_interval)) {
+        ProfileSection section("heap");
+        HeapSample sample = sampleHeap();
+        if (heap_low_callback) {
+            float seconds = getSecondsToHeapExhaustion();
+            bool low = sample.largest < heap_reserve || (!std::isnan(seconds) && seconds < heap_horizon);
+            if (low && !heap_low) {
+                Log.warn("low memory: largest free block %lu bytes (free %lu), exhaustion forecast in %.0f s",
+                    sample.largest, sample.free, seconds);
+                heap_low_callback(sample, seconds);
+            }
+            heap_low = low;
+        }
+    }
+    // scan the thread stacks
+    if (stack_sample_interval > 0 && (stack_last_sampled == 0 || millis() - stack_last_sampled > stack_sample_interval)) {
+        ProfileSection section("stack");
+        sampleStacks();
+    }
+    // send queued I2C writes
+    {
+        ProfileSection section("i2c");
+        LoggerI2C::loop();
+    }
 }
\ No newline at end of file
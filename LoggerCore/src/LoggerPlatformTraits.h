@@ -0,0 +1,87 @@
+#pragma once
+#include "Particle.h"
+
+// address issue where this is not defined anymore in newer firmware
+#ifndef PLATFORM_PHOTON
+#define PLATFORM_PHOTON 0
+#endif
+
+/**
+ * @brief compile time platform traits (connectivity and memory) and the buffer sizes derived from them
+ * this header has no dependencies beyond Particle.h so any LoggerCore class can size its buffers from it,
+ * LoggerPlatform builds its runtime functions on top of the same traits
+ */
+namespace LoggerPlatformTraits {
+
+    // byte size constants
+    constexpr size_t B = 1;
+    constexpr size_t KB = 1024;
+    constexpr size_t MB = 1024 * 1024;
+
+    // unknown platform (no wifi/cellular, no flash file system, unknown RAM)
+    template <int platform_id>
+    struct Traits {
+        static constexpr bool wifi = false;
+        static constexpr bool cellular = false;
+        static constexpr size_t flash_size = 0; // bytes of flash file system
+        static constexpr size_t sector_size = 4 * KB; // bytes per flash sector
+        static constexpr size_t ram_size = 0; // bytes of RAM available to the user application (approximate)
+    };
+
+    template <>
+    struct Traits<PLATFORM_PHOTON> : Traits<-1> {
+        static constexpr bool wifi = true;
+        static constexpr size_t ram_size = 60 * KB;
+    };
+
+    template <>
+    struct Traits<PLATFORM_ARGON> : Traits<-1> {
+        static constexpr bool wifi = true;
+        static constexpr size_t flash_size = 2 * MB;
+        static constexpr size_t ram_size = 80 * KB;
+    };
+
+    template <>
+    struct Traits<PLATFORM_BORON> : Traits<-1> {
+        static constexpr bool cellular = true;
+        static constexpr size_t flash_size = 2 * MB;
+        static constexpr size_t ram_size = 80 * KB;
+    };
+
+    template <>
+    struct Traits<PLATFORM_P2> : Traits<-1> {
+        static constexpr bool wifi = true;
+        static constexpr size_t flash_size = 2 * MB;
+        static constexpr size_t ram_size = 3 * MB;
+    };
+
+    // traits of the platform this is compiled for
+    using Current = Traits<PLATFORM_ID>;
+
+    constexpr size_t clamp(size_t value, size_t min, size_t max) {
+        return(value < min ? min : (value > max ? max : value));
+    }
+
+    // RAM budget for the library's fixed buffers (1/16th of the RAM) and the reserve to keep free for the system
+    constexpr size_t ram_budget = Current::ram_size / 16;
+    constexpr size_t ram_reserve = clamp(Current::ram_size / 6, 10 * KB, 64 * KB);
+
+    // approximate heap footprint of one call/audit record (a Variant map with a handful of short entries)
+    constexpr size_t record_size = 256;
+
+    // derived buffer sizes
+    constexpr size_t deferred_calls = clamp(ram_budget / 4 / record_size, 2, 32); // LoggerFunction deferred call queue
+    constexpr size_t command_slots = clamp(ram_budget / 2 / record_size, 4, 64); // LoggerPublisher command record slots
+    constexpr size_t sd_buffer_size = clamp(ram_budget / 4, 32, 4 * KB) / 32 * 32; // LoggerSD write buffer (multiple of the I2C buffer)
+
+    // storage tiers (LoggerStorage): RAM hot tier (on the heap, outside the budget) and flash warm tier
+    constexpr size_t storage_hot_size = clamp(Current::ram_size / 8, 4 * KB, 256 * KB);
+    constexpr size_t storage_warm_size = Current::flash_size / 4;
+
+    // the derived buffers have to fit into the budget (skipped for unknown platforms)
+    static_assert(Current::ram_size == 0 || (deferred_calls + command_slots) * record_size + sd_buffer_size <= ram_budget,
+        "buffer sizes exceed the RAM budget of this platform");
+    static_assert(Current::ram_size == 0 || ram_budget + ram_reserve < Current::ram_size,
+        "RAM budget and reserve exceed the RAM of this platform");
+
+}
@@ -1,5 +1,6 @@
 #include "Particle.h"
 #include "LoggerPublisher.h"
+#include "LoggerPlatform.h"
 
 bool LoggerPublisher::publish(const Variant &data) {
     return(true);
@@ -37,7 +38,25 @@ void LoggerPublisher::queueData(const Variant &data) {
     m_burst_data.append(data);
 }
 
+void LoggerPublisher::queueData(Variant &&data) {
+    m_burst_ongoing = true;
+    m_last_burst_data = millis();
+    m_burst_data.append(std::move(data));
+}
+
+bool LoggerPublisher::queueCommand(Variant &&record) {
+    std::lock_guard<std::mutex> lock(m_cmd_mutex);
+    if (m_cmd_n >= m_cmd_slots_size) {
+        m_cmd_dropped++;
+        return(false);
+    }
+    m_cmd_slots[(m_cmd_first + m_cmd_n) % m_cmd_slots_size] = std::move(record);
+    m_cmd_n++;
+    return(true);
+}
+
 void LoggerPublisher::queueBurst() {
+    LoggerPlatform::ProfileSection section("burst");
     Variant burst;
     if (DeviceNameHelperEEPROM::instance().hasName()) {
         // device name is available
@@ -47,16 +66,17 @@ void LoggerPublisher::queueBurst() {
         burst.set("id", System.deviceID());
     }
     burst.set("b", m_burst_data);
-    Log.trace("adding burst to queue: %s", burst.toJSON().c_str());
-    m_data_queue.append(burst);
+    String json = burst.toJSON();
+    Log.trace("adding burst to queue: %s", json.c_str());
+    m_storage->append(json);
     m_burst_data.clear();
 
     // sd backup
     if (m_use_sd_backup) {
-        Log.trace("backing up burst on SD card in file %s", m_sd_log_file.c_str());
+        Log.trace("backing up burst on SD card");
         if (m_sd->available()) {
-            m_sd->append(m_sd_log_file.c_str());
-            m_sd->println(burst.toJSON().c_str());
+            LoggerPlatform::ProfileSection section("sd");
+            m_sd_log->append(json.c_str());
             m_sd->syncFile();
         } else {
             Log.error("SD card unavailable, burst could not be backed up");
@@ -79,17 +99,49 @@ void LoggerPublisher::setup() {
     } else {
         Log.info("starting logger (without SD backup)");
     }
-    m_sd_log_file = String::format("device_%s.log", System.deviceID().c_str());
+    // short name (end of the device ID): the file names have to fit into a single I2C transaction with the command
+    String id = System.deviceID();
+    m_sd_log = new LoggerSDLog(m_sd, String::format("d%s", id.substring(id.length() - 8).c_str()));
+
+    // storage tiers (SD card only with SD backup)
+    m_storage = new LoggerStorage(m_use_sd_backup ? m_sd : nullptr, m_RAM_reserve);
+    m_storage->setup();
 }
 
 void LoggerPublisher::loop() {
 
+    // reconnect the SD card if it's missing
+    if (m_use_sd_backup) m_sd->loop();
+
+    // move command records into the burst data
+    while (m_cmd_n > 0) {
+        Variant record;
+        {
+            std::lock_guard<std::mutex> lock(m_cmd_mutex);
+            record = std::move(m_cmd_slots[m_cmd_first]);
+            m_cmd_slots[m_cmd_first] = Variant();
+            m_cmd_first = (m_cmd_first + 1) % m_cmd_slots_size;
+            m_cmd_n--;
+        }
+        queueData(std::move(record));
+    }
+    if (m_cmd_dropped > 0) {
+        Log.warn("%d command records were dropped because all %d slots were taken", m_cmd_dropped, m_cmd_slots_size);
+        m_cmd_dropped = 0;
+    }
+
     // check for end of a data burst
     if (m_burst_ongoing && (millis() - m_last_burst_data) > m_wait_for_burst_data) {
         queueBurst();
         m_burst_ongoing = false;
     }
 
+    // demote stored bursts under memory pressure, promote them back to RAM while connected
+    {
+        LoggerPlatform::ProfileSection section("storage");
+        m_storage->loop(Particle.connected());
+    }
+
     // check on publish state
     switch(m_publish_state) {
 
@@ -99,8 +151,8 @@ void LoggerPublisher::loop() {
                 // connected!
                 m_state_time = millis();
                 m_publish_state = State::WAIT_PUBLISH;
-            } else if ( !m_data_queue.isEmpty()) {
-                // we've got data but no connection --> store on disc
+            } else if ( !m_storage->isEmpty()) {
+                // we've got data but no connection --> stays in storage (demoted to flash/SD under memory pressure)
 
             }
             break;
@@ -110,10 +162,10 @@ void LoggerPublisher::loop() {
             if (!Particle.connected()) {
                 // disconnected!
                 m_publish_state = State::WAIT_CONNECT;
-            } else if ( !m_data_queue.isEmpty() && 
+            } else if ( !m_storage->isEmpty() && 
                 (millis() - m_state_time) > m_wait_after_connect) {
                 // we've got data and a stable connection
-                
+                // --> publish m_storage->peek() (read from the fastest tier) and m_storage->pop() once it is sent
             }
             break;
 
@@ -235,13 +287,35 @@ bool LoggerPublisher::testSD() {
 
     // read back test file
     Log.info("reading back test file sd_test.txt");
-    byte buffer[4] = {0, 0, 0, 0};
-    m_sd->read(buffer, 4, "sd_test.txt");
-    if (buffer[0] != 't' || buffer[1] != 'e' || buffer[2] != 's' || buffer[3] != 't')  {
+    LoggerSDReader reader(m_sd);
+    char buffer[5] = "";
+    if (!reader.open("sd_test.txt") || !reader.readLine(buffer, sizeof(buffer)) || strcmp(buffer, "test") != 0)  {
         Log.error("could not confirm correct test file contents");
         return(false);
     } 
     
     Log.info("successfully recovered file content, SD card test complete");
     return(true);
+}
+
+Variant LoggerPublisher::benchmarkSD(size_t bytes) {
+    Log.info("running SD write benchmark with %d bytes", bytes);
+
+    // check enabled and available
+    if (!m_use_sd_backup || !m_sd->available()) {
+        Log.error("cannot benchmark SD, logger is not using SD backup or SD card is not available");
+        return(Variant());
+    }
+
+    Variant results = m_sd->benchmark("sd_bench.txt", bytes);
+    Log.info("SD write benchmark complete (bytes/s): %s", results.toJSON().c_str());
+    return(results);
+}
+
+size_t LoggerPublisher::exportSD(uint32_t from, uint32_t to, Print& out) {
+    if (!m_use_sd_backup || !m_sd->available()) {
+        Log.error("cannot export SD, logger is not using SD backup or SD card is not available");
+        return(0);
+    }
+    return(m_sd_log->exportRange(from, to, out));
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "Particle.h"
+#include <mutex>
 #include "LoggerSD.h"
+#include "LoggerSDLog.h"
+#include "LoggerStorage.h"
+#include "LoggerPlatformTraits.h"
 
 // device name logger
 // dependencies.DeviceNameHelperRK=0.0.1
@@ -22,7 +26,7 @@ class LoggerPublisher {
         // SD card backup
         LoggerSD* m_sd = new LoggerSD();
         bool m_use_sd_backup; // whether to backup data on external SD card
-        String m_sd_log_file;
+        LoggerSDLog* m_sd_log = nullptr; // rotating, indexed log of the bursts
 
         // data bursts
         VariantArray m_burst_data; // stack of data from a burst
@@ -30,8 +34,17 @@ class LoggerPublisher {
         const uint m_wait_for_burst_data; // ms to wait for more burst data to arrive
         bool m_burst_ongoing = false; // flag for when we're in a data burst
 
-        // memory queue for publishing
-        Variant m_data_queue; // stack of data from collection of bursts
+        // command audit records (e.g. from LoggerFunction) waiting to be added to the burst data
+        // records are moved into preallocated slots so handing them over never allocates (safe in the Particle.function handler)
+        static const size_t m_cmd_slots_size = LoggerPlatformTraits::command_slots; // number of slots (sized for the platform)
+        Variant m_cmd_slots[m_cmd_slots_size]; // ring buffer of records
+        size_t m_cmd_first = 0; // index of the oldest record
+        size_t m_cmd_n = 0; // number of records in the slots
+        uint m_cmd_dropped = 0; // number of records dropped because all slots were taken
+        std::mutex m_cmd_mutex; // guards the slots (filled from the system thread, drained from loop)
+
+        // storage for publishing (bursts as JSON in RAM, flash or SD card)
+        LoggerStorage* m_storage = nullptr;
         const uint m_RAM_reserve; // memory reserve in bytes
         void queueBurst(); // internal method to move a burst into the queue
 
@@ -61,7 +74,7 @@ class LoggerPublisher {
             "publish-test", // event name 
             true,           // use_sd_backup
             500,            // wait_for_burst_data (in ms) --> default: 500 ms
-            10 * 1024       // RAM_reserve (in bytes) --> default: 10 kb
+            LoggerPlatformTraits::ram_reserve // RAM_reserve (in bytes) --> default: 1/6th of the RAM (10 to 64 kb)
         ) {};
 
         LoggerPublisher(const char *event_name, const bool use_sd_backup, const uint wait_for_burst_data, const uint RAM_reserve) : 
@@ -70,6 +83,14 @@ class LoggerPublisher {
         bool publish(const Variant &data);
         
         void queueData(const Variant &data);
+        void queueData(Variant &&data); // moves the data instead of copying it
+
+        /**
+         * @brief hand over a command audit record (e.g. with LoggerFunction::setLogger(publisher, &LoggerPublisher::queueCommand))
+         * the record is moved into a preallocated slot without copying or serializing it and added to the burst data in loop()
+         * returns false if all slots are taken (the record is dropped)
+         */
+        bool queueCommand(Variant &&record);
         bool hasData() { return(m_burst_data.isEmpty()); };
 
         int getQueueSize() { return(m_burst_data.size()); };
@@ -91,8 +112,28 @@ class LoggerPublisher {
          */
         void useSdBackup(bool use);
 
+        /**
+         * @brief replace the SD card transport (e.g. with a LoggerSDEmulator for testing without the hardware), call before setup()
+         */
+        void setSdPort(LoggerSDPort* port) { m_sd->setPort(port); };
+
         /**
          * @brief method to test SD reading/writing capabilities
          */
         bool testSD();
+
+        /**
+         * @brief method to benchmark SD write speeds (bytes/s), see LoggerSD::benchmark()
+         */
+        Variant benchmarkSD(size_t bytes = 4096);
+
+        /**
+         * @brief copy the SD backup of a time window (Time.now() values) to out (e.g. Serial), see LoggerSDLog::exportRange()
+         */
+        size_t exportSD(uint32_t from, uint32_t to, Print& out);
+
+        /**
+         * @brief capacity, occupancy and throughput of the storage tiers (RAM, flash, SD), see LoggerStorage::getMetrics()
+         */
+        Variant getStorageMetrics() { return(m_storage ? m_storage->getMetrics() : Variant()); };
 };
\ No newline at end of file
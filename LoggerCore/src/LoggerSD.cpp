@@ -1,34 +1,497 @@
 #include "Particle.h"
 #include "LoggerSD.h"
 
-void LoggerSD::init() {
-    present = false;   
-    Log.trace("checking for SD card reader at I2C address 0x%02X", i2c_address);
-    Wire.begin();
-    Wire.beginTransmission(i2c_address);
-    present = (Wire.endTransmission() == 0);
-    if (present) {
-        Log.info("SD card reader found at I2C address 0x%02X.", i2c_address);
-        Log.trace("initializing SD card");    
-        present = OpenLog::begin(i2c_address);
-        if (present) {
+bool LoggerSD::probe() {
+    last_probe = millis();
+    Log.trace("checking for SD card reader");
+    bool found = port->ping();
+    bool initialized = false;
+    if (found) {
+        Log.info("SD card reader found.");
+        Log.trace("initializing SD card");
+        uint8_t status = getStatus();
+        initialized = (status != 0xFF && (status & OpenLogRegister::status_sd_init_good));
+        if (initialized) {
             Log.info("SD card initialized successfully.");
         } else {
             Log.warn("cannot use SD card, card failed to initialize (card missing?)");
         }
     } else {
-        Log.warn("cannot use SD card, no SD card reader found at I2C address 0x%02X.", i2c_address);
+        Log.warn("cannot use SD card, no SD card reader found.");
+    }
+
+    open_file = "";
+    recovered_file = "";
+    buffered = 0;
+    port->flush(); // drop whatever is still queued
+    read_stream++;
+    if (initialized) {
+        state = State::PRESENT;
+        failures = 0;
+        probe_backoff = 0;
+    } else {
+        state = State::ABSENT;
+        probe_backoff = probe_backoff == 0 ? probe_backoff_min : std::min(2 * probe_backoff, probe_backoff_max);
+        Log.trace("next SD card check in %lu ms", probe_backoff);
+    }
+    return(initialized);
+}
+
+bool LoggerSD::track(bool success) {
+    if (success) {
+        if (state == State::DEGRADED) Log.info("SD card recovered");
+        state = State::PRESENT;
+        failures = 0;
+    } else if (state != State::ABSENT) {
+        failures++;
+        if (failures >= max_failures) {
+            Log.error("SD card failed %d times in a row, considering it absent", failures);
+            state = State::ABSENT;
+            last_probe = millis();
+            probe_backoff = probe_backoff_min;
+        } else {
+            state = State::DEGRADED;
+        }
+    }
+    return(success);
+}
+
+void LoggerSD::init() {
+    probe_backoff = 0;
+    probe();
+}
+
+void LoggerSD::setPort(LoggerSDPort* port) {
+    this->port = port;
+    state = State::ABSENT;
+    probe_backoff = 0;
+}
+
+// commands
+bool LoggerSD::command(uint8_t reg, const String& file) {
+    flushBuffer();
+    return(port->transmit(reg, (const uint8_t*) file.c_str(), file.length()));
+}
+
+int32_t LoggerSD::receiveInt() {
+    uint8_t data[4];
+    if (port->receive(data, 4) != 4) return(-1);
+    return((int32_t) ((uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | data[3]));
+}
+
+uint8_t LoggerSD::getStatus() {
+    uint8_t status;
+    if (!port->transmit(OpenLogRegister::status) || port->receive(&status, 1) != 1) return(0xFF);
+    return(status);
+}
+
+int32_t LoggerSD::size(const String& file) {
+    if (!command(OpenLogRegister::file_size, file)) return(-1);
+    return(receiveInt());
+}
+
+const char* LoggerSD::getStateName() {
+    switch(state) {
+        case State::PRESENT: return("present");
+        case State::DEGRADED: return("degraded");
+        default: return("absent");
     }
 }
 
-bool LoggerSD::available() {
-    if (!present) init();
-    return(present);
+bool LoggerSD::append(const String& file) {
+    if (!available()) return(false);
+    if (open_file == file) return(true);
+    // send what's buffered for the previous file first (only a failure is tracked, an empty flush does not show the card works)
+    if (!flushBuffer()) {
+        track(false);
+        return(false);
+    }
+    read_stream++;
+    bool opened = track(command(OpenLogRegister::open_file, file));
+    open_file = opened ? file : "";
+    return(opened);
+}
+
+uint32_t LoggerSD::removeFile(const String& file) {
+    if (open_file == file) {
+        buffered = 0;
+        open_file = "";
+    }
+    if (!command(OpenLogRegister::remove, file)) return(0);
+    // give the reader time to remove the file before asking for the result
+    delay(50);
+    int32_t removed = receiveInt();
+    return(removed > 0 ? removed : 0);
+}
+
+size_t LoggerSD::write(uint8_t c) {
+    return(write(&c, 1));
+}
+
+size_t LoggerSD::write(const uint8_t* data, size_t size) {
+    if (!available()) return(0);
+    size_t written = 0;
+    while (written < size) {
+        size_t n = std::min(size - written, sizeof(buffer) - buffered);
+        memcpy(buffer + buffered, data + written, n);
+        buffered += n;
+        written += n;
+        if (buffered == sizeof(buffer) && !track(queueBuffer())) break;
+    }
+    return(written);
+}
+
+bool LoggerSD::queueBuffer() {
+    // queued in transactions of the register byte + as much data as fits into the I2C buffer,
+    // when the port's queue is full (back-pressure) what is already queued is sent first
+    const size_t chunk = I2C_BUFFER_LENGTH - 1;
+    bool success = true;
+    for (size_t i = 0; i < buffered && success; i += chunk) {
+        size_t n = std::min(chunk, buffered - i);
+        if (!port->queue(OpenLogRegister::write_file, buffer + i, n)) {
+            success = port->flush() && port->queue(OpenLogRegister::write_file, buffer + i, n);
+        }
+    }
+    if (!success) Log.error("sending data to SD card failed, data lost");
+    buffered = 0;
+    return(success);
+}
+
+bool LoggerSD::flushBuffer() {
+    bool success = queueBuffer();
+    if (!port->flush()) {
+        Log.error("sending queued data to SD card failed, data lost");
+        success = false;
+    }
+    return(success);
 }
 
 bool LoggerSD::syncFile() {
-    // reset present if card available but sync fails
-    if (available()) present = OpenLog::syncFile();
-    if (!present) Log.error("writing to SD card failed");
-    return(present);
-}
\ No newline at end of file
+    if (!available()) return(false);
+    bool synced = track(flushBuffer() && port->transmit(OpenLogRegister::sync_file));
+    if (!synced) Log.error("writing to SD card failed");
+    return(synced);
+}   
+
+void LoggerSD::loop() {
+    // probe for an absent card once the backoff has passed
+    if (state == State::ABSENT && millis() - last_probe > probe_backoff) {
+        probe();
+    }
+}
+
+// reading
+bool LoggerSD::openRead(const String& file) {
+    if (!available()) return(false);
+    // the reader may share the file handle with writing so finish writing first and re-open afterwards
+    flushBuffer();
+    open_file = "";
+    read_stream++;
+    return(track(command(OpenLogRegister::read_file, file)));
+}
+
+size_t LoggerSD::readBlock(uint8_t* data, size_t size) {
+    size_t n = std::min(size, (size_t) I2C_BUFFER_LENGTH);
+    size_t received = port->receive(data, n);
+    track(received == n);
+    return(received);
+}
+
+// framed records
+uint32_t LoggerSD::crc32(const uint8_t* data, size_t length, uint32_t crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return(~crc);
+}
+
+size_t LoggerSD::appendRecord(const String& file, const char* data) {
+    if (!available()) return(0);
+    // the sequence of a file must be recovered before appending to it (so no sequence numbers are reused)
+    if (recovered_file != file && !recover(file)) return(0);
+    if (!append(file)) return(0);
+
+    // sync marker
+    size_t bytes = 0;
+    if (resync) {
+        bytes += printf("\n~sync %lu\n", record_seq);
+        resync = false;
+    } else if (record_seq % sync_every == 0) {
+        bytes += printf("~sync %lu\n", record_seq);
+    }
+
+    // record
+    size_t length = strlen(data);
+    bytes += printf("#%lu:%u:%08lx:", record_seq, length, crc32((const uint8_t*) data, length));
+    bytes += write((const uint8_t*) data, length);
+    bytes += write('\n');
+    record_seq++;
+    return(available() ? bytes : 0);
+}
+
+bool LoggerSD::recover(const String& file, uint32_t offset, uint32_t offset_seq) {
+    if (!available()) return(false);
+    int32_t file_size = size(file);
+    // no answer is not a missing file (the sequence would start over)
+    if (file_size < 0 && !track(getStatus() != 0xFF)) return(false);
+    if (file_size <= 0) {
+        // new file (continues the current sequence)
+        recovered_file = file;
+        resync = true;
+        return(true);
+    }
+
+    // one pass from the checkpoint to the end of the file (the reader can only stream from the start, the bytes
+    // before the offset are read and dropped, not parsed)
+    enum struct Scan { LINE_START, HEADER, DATA, LINE_END, SKIP };
+    LoggerSDReader reader(this);
+    unsigned long start = millis();
+    if (!reader.open(file.c_str(), offset)) return(false);
+
+    // parse the frames byte by byte (a record's data is never held in memory), keeping the last valid one
+    bool found = offset > 0 && reader.position() == offset; // the checkpoint itself ends a valid record
+    uint32_t next_seq = offset_seq, last_end = reader.position();
+    Scan scan = Scan::LINE_START;
+    char header[32];
+    size_t header_length = 0;
+    uint32_t seq = 0, length = 0, crc = 0, remaining = 0, running = 0;
+    bool marker = false;
+    uint32_t position = reader.position();
+    const uint8_t* chunk;
+    size_t chunk_size;
+    while ((chunk = reader.nextChunk(chunk_size)) != nullptr) {
+        for (size_t i = 0; i < chunk_size; i++, position++) {
+            char c = chunk[i];
+            switch(scan) {
+                case Scan::LINE_START:
+                    if (c == '#' || c == '~') {
+                        marker = (c == '~');
+                        header_length = 0;
+                        header[0] = '\0';
+                        scan = Scan::HEADER;
+                    } else if (c != '\n') {
+                        scan = Scan::SKIP;
+                    }
+                    break;
+                case Scan::HEADER:
+                    if (marker && c == '\n') {
+                        // sync marker: next record has this sequence number
+                        header[header_length] = '\0';
+                        unsigned long marker_seq;
+                        if (sscanf(header, "sync %lu", &marker_seq) == 1 && marker_seq > next_seq) next_seq = marker_seq;
+                        scan = Scan::LINE_START;
+                    } else if (c == '\n' || header_length >= sizeof(header) - 1) {
+                        scan = c == '\n' ? Scan::LINE_START : Scan::SKIP;
+                    } else if (!marker && c == ':' && header_length > 0 && strchr(header, ':') != strrchr(header, ':')) {
+                        // third ':' ends the header
+                        header[header_length] = '\0';
+                        unsigned long h_seq, h_length, h_crc;
+                        if (sscanf(header, "%lu:%lu:%lx", &h_seq, &h_length, &h_crc) == 3) {
+                            seq = h_seq; length = h_length; crc = h_crc;
+                            remaining = length;
+                            running = 0;
+                            scan = length > 0 ? Scan::DATA : Scan::LINE_END;
+                        } else {
+                            scan = Scan::SKIP;
+                        }
+                    } else {
+                        header[header_length++] = c;
+                        header[header_length] = '\0';
+                    }
+                    break;
+                case Scan::DATA:
+                    if (c == '\n') {
+                        scan = Scan::LINE_START; // truncated record
+                    } else {
+                        running = crc32((const uint8_t*) &c, 1, running);
+                        if (--remaining == 0) scan = Scan::LINE_END;
+                    }
+                    break;
+                case Scan::LINE_END:
+                    if (c == '\n' && running == crc) {
+                        found = true;
+                        if (seq + 1 > next_seq) next_seq = seq + 1;
+                        last_end = position + 1;
+                        scan = Scan::LINE_START;
+                    } else {
+                        scan = c == '\n' ? Scan::LINE_START : Scan::SKIP;
+                    }
+                    break;
+                case Scan::SKIP:
+                    if (c == '\n') scan = Scan::LINE_START;
+                    break;
+            }
+        }
+    }
+
+    // the whole file must have been read, otherwise a later record could be missed and its sequence number reused
+    if (position < (uint32_t) file_size) {
+        Log.error("could not read all of '%s' (%lu of %ld bytes), sequence not recovered", file.c_str(), position, file_size);
+        return(false);
+    }
+
+    record_seq = next_seq;
+    recovered_file = file;
+    resync = true;
+    if (found) {
+        Log.info("recovered '%s' in %lu ms (validated from byte %lu): next record #%lu, %lu bytes after the last valid record",
+            file.c_str(), millis() - start, offset, record_seq, file_size - last_end);
+    } else {
+        Log.warn("no valid records found in '%s', next record #%lu", file.c_str(), record_seq);
+    }
+    return(true);
+}
+
+// bus speed
+bool LoggerSD::useFastMode(bool fast) {
+    if (!fast) {
+        if (port->getClockSpeed() != CLOCK_SPEED_100KHZ) {
+            Log.info("switching I2C bus to 100 kHz");
+            port->setClockSpeed(CLOCK_SPEED_100KHZ);
+        }
+        return(false);
+    }
+    if (port->getClockSpeed() == CLOCK_SPEED_400KHZ) return(true);
+    if (!available()) return(false);
+
+    // same devices at fast mode? (and the reader still responds)
+    if (port->setClockSpeed(CLOCK_SPEED_400KHZ) && getStatus() != 0xFF) {
+        Log.info("switched I2C bus to 400 kHz");
+        return(true);
+    }
+    Log.warn("not all I2C devices support 400 kHz, staying at 100 kHz");
+    port->setClockSpeed(CLOCK_SPEED_100KHZ);
+    return(false);
+}
+
+// benchmark
+Variant LoggerSD::benchmark(const char* file, size_t bytes) {
+    Variant results;
+    if (!available()) return(results);
+    uint32_t previous_speed = port->getClockSpeed();
+
+    // test data (lines of 64 characters)
+    uint8_t data[64];
+    for (size_t i = 0; i < sizeof(data) - 1; i++) data[i] = 'a' + i % 26;
+    data[sizeof(data) - 1] = '\n';
+
+    auto run = [&](bool bulk) -> float {
+        removeFile(file);
+        if (!append(file)) return(NAN);
+        unsigned long start = micros();
+        for (size_t i = 0; i < bytes; i += sizeof(data)) {
+            size_t n = std::min(sizeof(data), bytes - i);
+            if (bulk) {
+                write(data, n);
+            } else {
+                for (size_t j = 0; j < n; j++) port->transmit(OpenLogRegister::write_file, data + j, 1);
+            }
+        }
+        if (!syncFile()) return(NAN);
+        unsigned long us = micros() - start;
+        return(us > 0 ? bytes * 1e6f / us : NAN);
+    };
+
+    useFastMode(false);
+    results.set("byte_100k", run(false));
+    results.set("bulk_100k", run(true));
+    if (useFastMode(true)) {
+        results.set("byte_400k", run(false));
+        results.set("bulk_400k", run(true));
+    }
+    removeFile(file);
+    useFastMode(previous_speed == CLOCK_SPEED_400KHZ);
+    return(results);
+}
+
+// streaming reader
+bool LoggerSDReader::open(const char* file, uint32_t offset) {
+    opened = false;
+    filled = 0;
+    consumed = 0;
+    requested = 0;
+    pos = 0;
+    if (!sd->available()) return(false);
+    int32_t file_bytes = sd->size(file);
+    if (file_bytes < 0 || !sd->openRead(file)) {
+        Log.error("cannot read '%s' from SD card", file);
+        return(false);
+    }
+    file_size = file_bytes;
+    stream = sd->getReadStream();
+    opened = true;
+
+    // skip to the offset
+    uint8_t skip[I2C_BUFFER_LENGTH];
+    uint32_t target = std::min(offset, file_size);
+    while (requested < target) {
+        size_t n = sd->readBlock(skip, std::min((uint32_t) sizeof(skip), target - requested));
+        if (n == 0) {
+            opened = false;
+            return(false);
+        }
+        requested += n;
+    }
+    pos = requested;
+    return(true);
+}
+
+bool LoggerSDReader::refill() {
+    if (consumed < filled) return(true); // buffer not used up yet
+    filled = 0;
+    consumed = 0;
+    while (filled < chunk_size && requested < file_size) {
+        if (sd->getReadStream() != stream) break; // stream ended by another command
+        size_t want = std::min((uint32_t) (chunk_size - filled), file_size - requested);
+        size_t got = sd->readBlock(buffer.get() + filled, want);
+        if (got == 0) {
+            // card stopped responding, treat as the end of the file
+            file_size = requested;
+            break;
+        }
+        filled += got;
+        requested += got;
+    }
+    return(filled > 0);
+}
+
+const uint8_t* LoggerSDReader::nextChunk(size_t& size) {
+    size = 0;
+    if (!opened || !refill()) return(nullptr);
+    const uint8_t* chunk = buffer.get() + consumed;
+    size = filled - consumed;
+    consumed = filled;
+    pos += size;
+    return(chunk);
+}
+
+bool LoggerSDReader::readLine(char* line, size_t max_length) {
+    if (!opened || max_length == 0) return(false);
+    size_t length = 0;
+    bool any = false;
+    while (refill()) {
+        any = true;
+        char c = buffer[consumed++];
+        pos++;
+        if (c == '\n') break;
+        if (c != '\r' && length < max_length - 1) line[length++] = c;
+    }
+    line[length] = '\0';
+    return(any);
+}
+
+bool LoggerSDReader::readLine(String& line) {
+    line = "";
+    if (!opened) return(false);
+    bool any = false;
+    while (refill()) {
+        any = true;
+        char c = buffer[consumed++];
+        pos++;
+        if (c == '\n') break;
+        if (c != '\r') line += c;
+    }
+    return(any);
+}
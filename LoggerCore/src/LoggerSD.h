@@ -1,31 +1,209 @@
 #pragma once
 
 
-// open log library for data logging on SD card
-// dependencies.SparkFun_Qwiic_OpenLog_Arduino_Library=3.0.1
-#include "SparkFun_Qwiic_OpenLog_Arduino_Library.h"
+// data logging on SD card with a Qwiic OpenLog (register protocol in LoggerSDPort.h)
+#include "LoggerSDPort.h"
+#include "LoggerPlatformTraits.h"
 
 // Display class handles displaying information
-class LoggerSD : public OpenLog {
+class LoggerSD : public Print {
+
+    public:
+
+        // connection state
+        enum struct State {
+            ABSENT,     // no reader/card, probed in loop() with exponential backoff
+            PRESENT,    // working
+            DEGRADED    // recent write/sync failures, still used until max_failures in a row
+        };
 
     private:
 
         // default Qwiic OpenLog I2C address
         const uint8_t i2c_address = 0x2a;
 
-        // sd card present
-        bool present = false;
+        // transport to the reader (the I2C bus unless replaced with setPort())
+        LoggerSDWirePort wire_port{i2c_address};
+        LoggerSDPort* port = &wire_port;
+
+        // send a command with a file name argument (after the queued writes)
+        bool command(uint8_t reg, const String& file);
+
+        // read a 4 byte (big endian) command response, returns -1 if nothing was received
+        int32_t receiveInt();
+
+        // sd card state
+        State state = State::ABSENT;
+        uint failures = 0; // write/sync failures in a row
+        const uint max_failures = 3; // failures in a row before the card is considered absent
+
+        // probe backoff
+        unsigned long last_probe = 0; // millis() of the last probe
+        unsigned long probe_backoff = 0; // ms to wait after the last probe before probing again
+        const unsigned long probe_backoff_min = 1000; // ms after the first failed probe
+        const unsigned long probe_backoff_max = 5 * 60 * 1000; // ms at most between probes
+
+        // probe for the reader and initialize the card (updates state and backoff)
+        bool probe();
+
+        // bulk writes: prints are collected in a buffer and sent to the OpenLog write register in
+        // transactions that fill the whole I2C buffer (instead of one byte per transaction), a full buffer is
+        // queued with the port (sent in the background, what is already queued is sent first when the port's queue is full)
+        // and everything queued is sent before the next command
+        uint8_t buffer[LoggerPlatformTraits::sd_buffer_size];
+        size_t buffered = 0; // bytes in the buffer
+        bool queueBuffer(); // queue the buffer with the port
+        bool flushBuffer(); // queue the buffer and send everything queued to the card
+
+        // file selection: the open file is remembered so appending to it again does not re-send the command
+        String open_file;
+
+        // read streams: incremented whenever a file command ends the current read stream
+        uint32_t read_stream = 0;
+
+        // framed records: "#<seq>:<length>:<crc32>:<data>\n" plus a "~sync <seq>\n" marker every sync_every records
+        // and whenever appending resumes after a recovery (the marker starts with a line end to terminate a damaged tail)
+        uint32_t record_seq = 0; // sequence number of the next record
+        const uint32_t sync_every = 64; // records between sync markers
+        bool resync = true; // whether the next record needs a sync marker first
+        String recovered_file; // file the sequence was recovered from (only set once recovery succeeded)
+
+        // record the outcome of a write/sync operation (updates state)
+        bool track(bool success);
 
     public:
 
         // initialize the sd reader
         void init();
 
-        // check if card is available
-        bool available();
+        // replace the transport (e.g. with a LoggerSDEmulator), call before init()
+        void setPort(LoggerSDPort* port);
+
+        // check if card is available (no bus access, the card is reconnected in loop())
+        bool available() { return(state != State::ABSENT); };
+
+        // current state
+        State getState() { return(state); };
+        const char* getStateName();
+
+        // select the file to write to (skipped if it is already open)
+        bool append(const String& file);
+
+        // remove a file (forgets it as the open file), returns the number of files removed
+        uint32_t removeFile(const String& file);
+
+        // size of a file in bytes, -1 if it does not exist
+        int32_t size(const String& file);
 
-        // sync file
+        // reader status bits (see OpenLogRegister), 0xFF if the reader does not respond
+        uint8_t getStatus();
+
+        // buffered writes (sent in full I2C transactions once the buffer is full or the file is synced)
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t* data, size_t size) override;
+
+        // sync file (sends the buffer first)
         bool syncFile();
 
+        // start streaming a file (from the beginning), use LoggerSDReader instead of calling this directly
+        bool openRead(const String& file);
+
+        // next block of the file being streamed (at most one I2C buffer), returns the number of bytes read
+        size_t readBlock(uint8_t* data, size_t size);
+
+        // current read stream (changes when another file command ended it)
+        uint32_t getReadStream() { return(read_stream); };
+
+        /**
+         * @brief CRC-32 (same as zlib's crc32) of data, pass the previous crc to continue a running crc
+         */
+        static uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+        /**
+         * @brief append a framed record (length, sequence number and CRC-32) to file, call syncFile() afterwards
+         * the first record written to a file recovers the sequence from the file first (see recover()), nothing is written if that fails
+         * returns the number of bytes written (including a sync marker if one was needed), 0 if the card is not available
+         */
+        size_t appendRecord(const String& file, const char* data);
+
+        // sequence number of the next record
+        uint32_t getRecordSeq() { return(record_seq); };
+
+        /**
+         * @brief find the last valid record of the file and continue the sequence after it
+         * (a new or empty file continues the current sequence)
+         * only the records from offset on are validated, starting from sequence number offset_seq (a checkpoint known to be
+         * at a record boundary, e.g. from the LoggerSDLog index), the card still streams the bytes before the offset
+         * (it can only stream from the start), so keep files small (e.g. LoggerSDLog segments)
+         * returns false if the file could not be read completely (recovery is then tried again by the next appendRecord())
+         */
+        bool recover(const String& file, uint32_t offset = 0, uint32_t offset_seq = 0);
+
+        /**
+         * @brief switch the bus to 400 kHz fast mode if every device that responds at 100 kHz still
+         * responds at 400 kHz (and the reader still works), falls back to 100 kHz otherwise
+         * returns whether fast mode is in use
+         */
+        bool useFastMode(bool fast = true);
+
+        /**
+         * @brief sustained write speed (bytes/s) of byte-wise and bulk writes at 100 kHz and (if supported) 400 kHz
+         * writes bytes of test data to file (removed afterwards), e.g. {"byte_100k": 210, "bulk_100k": 5400, ...}
+         */
+        Variant benchmark(const char* file, size_t bytes = 4096);
+
+        // must be called from the global loop (or the owning class' loop) to reconnect the card
+        void loop();
+
 };
 
+/**
+ * @brief streams a file from the SD card in fixed size chunks without loading it into RAM
+ * one chunk buffer that is refilled (one I2C block per transaction) when the consumer (nextChunk(), readLine()) has used it up
+ */
+class LoggerSDReader {
+
+    public:
+
+        // chunk size (half the SD buffer of this platform, a multiple of the I2C buffer)
+        static const size_t chunk_size = LoggerPlatformTraits::sd_buffer_size / 2;
+
+    private:
+
+        LoggerSD* sd;
+        std::unique_ptr<uint8_t[]> buffer; // chunk buffer (on the heap, too large for the stack on some platforms)
+        size_t filled = 0; // bytes in the buffer
+        size_t consumed = 0; // bytes of the buffer already consumed
+        uint32_t file_size = 0; // bytes in the file
+        uint32_t requested = 0; // bytes read from the card so far
+        uint32_t pos = 0; // bytes handed to the consumer so far
+        uint32_t stream = 0; // LoggerSD read stream this reader is using
+        bool opened = false;
+
+        // read the next chunk once the buffer is used up, returns false at the end of the file
+        bool refill();
+
+    public:
+
+        LoggerSDReader(LoggerSD* sd) : sd(sd), buffer(new uint8_t[chunk_size]) {};
+
+        // open file and skip to offset (the card can only stream from the start so the bytes before are read and dropped)
+        bool open(const char* file, uint32_t offset = 0);
+
+        // next chunk (all of the unconsumed buffer), returns nullptr at the end of the file
+        const uint8_t* nextChunk(size_t& size);
+
+        // next line (without the line end) into line, longer lines are truncated, returns false at the end of the file
+        bool readLine(char* line, size_t max_length);
+
+        // next line of any length (without the line end), returns false at the end of the file
+        bool readLine(String& line);
+
+        // whether another file command ended the stream (open() again to continue)
+        bool interrupted() { return(opened && sd->getReadStream() != stream); };
+
+        // info
+        uint32_t size() { return(file_size); };
+        uint32_t position() { return(pos); };
+        bool eof() { return(!opened || pos >= file_size); };
+};
@@ -0,0 +1,164 @@
+#include "Particle.h"
+#include "LoggerSDEmulator.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+
+bool LoggerSDEmulator::transaction(size_t n) {
+    transactions++;
+    if (!card_present) return(false);
+    if (n > max_transfer) {
+        Log.error("emulated SD: %d byte transaction exceeds the %d byte I2C buffer", n, max_transfer);
+        failures++;
+        return(false);
+    }
+    if (failure_rate > 0 && random(100) < failure_rate) {
+        failures++;
+        return(false);
+    }
+    // 9 clock cycles per byte (8 bits + ack) plus the address byte
+    delayMicroseconds(transaction_us + (n + 1) * 9 * 1000000UL / clock_speed);
+    bytes += n;
+    return(true);
+}
+
+String LoggerSDEmulator::path(const uint8_t* name, size_t length) {
+    String file = dir + "/";
+    for (size_t i = 0; i < length; i++) file += (char) name[i];
+    return(file);
+}
+
+void LoggerSDEmulator::respond(int32_t value) {
+    for (size_t i = 0; i < 4; i++) response[i] = (uint32_t) value >> (24 - 8 * i);
+    response_length = 4;
+}
+
+void LoggerSDEmulator::closeFiles() {
+    if (write_fd >= 0) close(write_fd);
+    if (read_fd >= 0) close(read_fd);
+    write_fd = -1;
+    read_fd = -1;
+}
+
+bool LoggerSDEmulator::ping() {
+    if (!dir_created) {
+        mkdir(dir.c_str(), 0777);
+        dir_created = true;
+    }
+    return(transaction(0));
+}
+
+bool LoggerSDEmulator::transmit(uint8_t reg, const uint8_t* data, size_t length) {
+    if (!transaction(1 + length)) return(false);
+    bool success = true;
+    response_length = 0;
+    struct stat info;
+
+    switch(reg) {
+        case OpenLogRegister::status:
+            response[0] = OpenLogRegister::status_sd_init_good | status;
+            response_length = 1;
+            break;
+        case OpenLogRegister::create_file: {
+            int fd = open(path(data, length).c_str(), O_WRONLY | O_CREAT, 0666);
+            success = fd >= 0;
+            if (success) close(fd);
+            break;
+        }
+        case OpenLogRegister::open_file:
+            if (write_fd >= 0) close(write_fd);
+            success = (write_fd = open(path(data, length).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666)) >= 0;
+            write_size = success && fstat(write_fd, &info) == 0 ? info.st_size : 0;
+            break;
+        case OpenLogRegister::write_file:
+            success = write_fd >= 0 && write(write_fd, data, length) == (ssize_t) length;
+            if (success) {
+                // the emulated card lives on the flash file system
+                LoggerPlatform::trackFlashWrite(write_size, write_size + length);
+                write_size += length;
+            }
+            break;
+        case OpenLogRegister::sync_file:
+            syncs++;
+            if (failing_syncs > 0) {
+                // the card write fails (e.g. card full or write protected), the device does not acknowledge
+                failing_syncs--;
+                failures++;
+                return(false);
+            }
+            if (write_fd >= 0) fsync(write_fd);
+            delay(sync_ms);
+            break;
+        case OpenLogRegister::file_size:
+            respond(stat(path(data, length).c_str(), &info) == 0 ? (int32_t) info.st_size : -1);
+            break;
+        case OpenLogRegister::read_file:
+            if (read_fd >= 0) close(read_fd);
+            success = (read_fd = open(path(data, length).c_str(), O_RDONLY)) >= 0;
+            break;
+        case OpenLogRegister::remove: {
+            // a removed file that is still open stays open until the next open command (same as the card)
+            String file = path(data, length);
+            bool removed = stat(file.c_str(), &info) == 0 && unlink(file.c_str()) == 0;
+            if (removed) LoggerPlatform::trackFlashDelete(info.st_size);
+            respond(removed ? 1 : 0);
+            break;
+        }
+        default:
+            // other commands (directories, version, ...) are acknowledged but have no effect
+            break;
+    }
+    status = success ? OpenLogRegister::status_last_command_success : 0;
+    return(true);
+}
+
+size_t LoggerSDEmulator::receive(uint8_t* data, size_t length) {
+    size_t n = std::min(length, max_transfer);
+    if (!transaction(n)) return(0);
+    if (response_length > 0) {
+        // response of the last command
+        n = std::min(n, response_length);
+        memcpy(data, response, n);
+        response_length = 0;
+        return(n);
+    }
+    if (read_fd < 0) return(0);
+    ssize_t received = read(read_fd, data, n);
+    return(received > 0 ? received : 0);
+}
+
+void LoggerSDEmulator::removeCard() {
+    card_present = false;
+    // the card has to be re-initialized (and files re-opened) once it is back
+    closeFiles();
+    response_length = 0;
+}
+
+void LoggerSDEmulator::format() {
+    closeFiles();
+    DIR* directory = opendir(dir.c_str());
+    if (directory == nullptr) return;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+        String file = dir + "/" + entry->d_name;
+        struct stat info;
+        if (stat(file.c_str(), &info) == 0 && unlink(file.c_str()) == 0) LoggerPlatform::trackFlashDelete(info.st_size);
+    }
+    closedir(directory);
+}
+
+Variant LoggerSDEmulator::getStats() {
+    Variant stats;
+    stats.set("transactions", transactions);
+    stats.set("bytes", bytes);
+    stats.set("failures", failures);
+    stats.set("syncs", syncs);
+    return(stats);
+}
+
+#endif
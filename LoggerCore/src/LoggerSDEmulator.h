@@ -0,0 +1,93 @@
+#pragma once
+#include "LoggerSDPort.h"
+#include "LoggerPlatform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+/**
+ * @brief emulates a Qwiic OpenLog at the register level with the files in a directory of the flash file system,
+ * for exercising LoggerSD (write batching, reconnection, record recovery) without the hardware:
+ * LoggerSD sd; LoggerSDEmulator emulator("/sdemu"); sd.setPort(&emulator); sd.init();
+ * latency: every transaction waits for the bytes it would put on the bus at the current clock plus a fixed overhead,
+ * syncs wait for the card write, transactions larger than the I2C buffer fail like they would on the bus
+ * failures: card removal (device stops acknowledging), failed syncs and a random transaction failure rate
+ * host: runs on the host file system with the Device OS stand-in, rake host:sd attaches it to the stand-in's Wire bus
+ * and checks LoggerSD/LoggerSDLog against it (also run by the host GitHub action)
+ */
+class LoggerSDEmulator : public LoggerSDPort {
+
+    private:
+
+        // directory that holds the card's files
+        const String dir;
+        bool dir_created = false;
+
+        // latency model
+        uint32_t clock_speed = CLOCK_SPEED_100KHZ;
+        uint32_t transaction_us = 50; // fixed overhead per transaction (addressing, OpenLog command processing)
+        uint32_t sync_ms = 5; // card write when syncing
+        size_t max_transfer = I2C_BUFFER_LENGTH; // bytes per transaction (including the register)
+
+        // injected failures
+        bool card_present = true; // false: the device does not acknowledge anything
+        uint32_t failing_syncs = 0; // number of upcoming syncs that fail
+        uint8_t failure_rate = 0; // percent of transactions that fail at random
+
+        // emulated device state
+        int write_fd = -1; // file open for appending
+        size_t write_size = 0; // its size (flash usage tracking)
+        int read_fd = -1; // file being streamed
+        uint8_t response[4]; // pending response of the last command (status, size, remove)
+        size_t response_length = 0;
+        uint8_t status = 0;
+
+        // counters
+        uint32_t transactions = 0;
+        uint32_t bytes = 0;
+        uint32_t failures = 0;
+        uint32_t syncs = 0;
+
+        // wait for a transaction of n bytes, returns false if it fails (card removed, too large, random failure)
+        bool transaction(size_t n);
+
+        // path of a file name sent with a command
+        String path(const uint8_t* name, size_t length);
+
+        // set the pending 4 byte response (big endian)
+        void respond(int32_t value);
+
+        void closeFiles();
+
+    public:
+
+        LoggerSDEmulator(const char* dir = "/sdemu") : dir(dir) {};
+        ~LoggerSDEmulator() { closeFiles(); };
+
+        // port
+        bool ping() override;
+        bool transmit(uint8_t reg, const uint8_t* data = nullptr, size_t length = 0) override;
+        size_t receive(uint8_t* data, size_t length) override;
+        bool setClockSpeed(uint32_t speed) override { clock_speed = speed; return(true); };
+        uint32_t getClockSpeed() override { return(clock_speed); };
+
+        // latency model
+        void setLatency(uint32_t transaction_us, uint32_t sync_ms) { this->transaction_us = transaction_us; this->sync_ms = sync_ms; };
+        void setMaxTransfer(size_t max_transfer) { this->max_transfer = max_transfer; };
+
+        // failure injection
+        void removeCard();
+        void insertCard() { card_present = true; };
+        void failSyncs(uint32_t n) { failing_syncs = n; };
+        void setFailureRate(uint8_t percent) { failure_rate = std::min(percent, (uint8_t) 100); };
+
+        // remove all files (empty card)
+        void format();
+
+        /**
+         * @brief transaction counters, e.g. {"transactions": 812, "bytes": 20480, "failures": 0, "syncs": 12}
+         */
+        Variant getStats();
+        void resetStats() { transactions = 0; bytes = 0; failures = 0; syncs = 0; };
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include "Particle.h"
+#include "LoggerSDLog.h"
+
+// files
+String LoggerSDLog::segmentFile(uint32_t number) {
+    return(String::format("%s_%04lu.log", name.c_str(), number));
+}
+
+String LoggerSDLog::indexFile() {
+    return(String::format("%s.idx", name.c_str()));
+}
+
+void LoggerSDLog::writeIndex(const String& line) {
+    if (!sd->append(indexFile())) return;
+    sd->print(line);
+    sd->write('\n');
+}
+
+// segments
+bool LoggerSDLog::load() {
+    if (!sd->available()) return(false);
+    segments.clear();
+
+    // segments from the index
+    LoggerSDReader reader(sd);
+    char line[64];
+    checkpoint = {0, 0, 0, 0};
+    if (sd->size(indexFile()) > 0 && reader.open(indexFile().c_str())) {
+        while (reader.readLine(line, sizeof(line))) {
+            unsigned long number, seq, time, offset;
+            if (sscanf(line, "s %lu %lu %lu", &number, &seq, &time) == 3) {
+                segments.append({(uint32_t) number, (uint32_t) seq, (uint32_t) time});
+            } else if (sscanf(line, "c %lu %lu %lu %lu", &number, &seq, &time, &offset) == 4) {
+                checkpoint = {(uint32_t) number, (uint32_t) seq, (uint32_t) time, (uint32_t) offset};
+            }
+        }
+    }
+
+    // segments deleted without the index being rewritten (e.g. reset during retention)
+    while (segments.size() > 1 && sd->size(segmentFile(segments.first().number)) < 0) {
+        segments.takeFirst();
+    }
+
+    // current segment
+    if (!segments.isEmpty()) {
+        String file = segmentFile(segments.last().number);
+        int32_t bytes = sd->size(file);
+        segment_bytes = bytes > 0 ? bytes : 0;
+        // only the records after the segment's last checkpoint need to be validated
+        bool recovered = checkpoint.offset > 0 && checkpoint.number == segments.last().number ?
+            sd->recover(file, checkpoint.offset, checkpoint.seq) : sd->recover(file);
+        if (!recovered) {
+            // like appendRecord(): nothing is written until the sequence is known (the next append loads again)
+            Log.error("SD log '%s' could not recover segment %lu", name.c_str(), segments.last().number);
+            return(false);
+        }
+        Log.info("SD log '%s' has %d segments, continuing segment %lu at %lu bytes", 
+            name.c_str(), segments.size(), segments.last().number, segment_bytes);
+    }
+    records = 0;
+    return(true);
+}
+
+void LoggerSDLog::rotate(uint32_t time) {
+    uint32_t number = segments.isEmpty() ? 0 : segments.last().number + 1;
+    segments.append({number, sd->getRecordSeq(), time});
+    segment_bytes = 0;
+    records = 0;
+    writeIndex(String::format("s %lu %lu %lu", number, sd->getRecordSeq(), time));
+    Log.info("SD log '%s' starts segment %lu with record #%lu", name.c_str(), number, sd->getRecordSeq());
+}
+
+void LoggerSDLog::applyRetention() {
+    if (segments.size() <= (int) std::max(max_segments, (size_t) 1)) return;
+    // one segment per call so a single append never deletes a batch
+    Segment oldest = segments.takeFirst();
+    Log.info("SD log '%s' deletes segment %lu (retention %d segments)", name.c_str(), oldest.number, max_segments);
+    sd->removeFile(segmentFile(oldest.number));
+
+    // rewrite the index only once every 1/8 of the retention (load() skips the lines of deleted segments until then),
+    // checkpoints of older segments are dropped (exports then start at their segment start)
+    if (++deleted < std::max(max_segments / 8, (size_t) 1)) return;
+    deleted = 0;
+    sd->removeFile(indexFile());
+    for (const Segment& segment : segments) {
+        writeIndex(String::format("s %lu %lu %lu", segment.number, segment.first_seq, segment.first_time));
+    }
+    if (checkpoint.number == segments.last().number && checkpoint.offset > 0) {
+        writeIndex(String::format("c %lu %lu %lu %lu", checkpoint.number, checkpoint.seq, checkpoint.time, checkpoint.offset));
+    }
+}
+
+bool LoggerSDLog::append(const char* data) {
+    if (!sd->available()) return(false);
+    if (!loaded) loaded = load();
+    if (!loaded) return(false);
+
+    // rotate?
+    uint32_t now = Time.isValid() ? Time.now() : 0;
+    if (segments.isEmpty() || segment_bytes >= max_bytes ||
+        (max_seconds > 0 && now > 0 && segments.last().first_time > 0 && now - segments.last().first_time >= max_seconds)) {
+        rotate(now);
+    }
+    applyRetention();
+    const Segment& current = segments.last();
+
+    // checkpoint
+    if (records >= checkpoint_every) {
+        checkpoint = {current.number, sd->getRecordSeq(), now, segment_bytes};
+        writeIndex(String::format("c %lu %lu %lu %lu", checkpoint.number, checkpoint.seq, checkpoint.time, checkpoint.offset));
+        records = 0;
+    }
+
+    size_t bytes = sd->appendRecord(segmentFile(current.number), data);
+    segment_bytes += bytes;
+    records++;
+    return(bytes > 0);
+}
+
+// export
+size_t LoggerSDLog::exportRange(uint32_t from, uint32_t to, Print& out) {
+    if (!sd->available()) return(0);
+    if (!loaded) loaded = load();
+    if (!loaded || segments.isEmpty()) return(0);
+
+    // start/stop offsets in each segment from the checkpoints
+    Vector<uint32_t> starts, stops;
+    for (int i = 0; i < segments.size(); i++) {
+        starts.append(0);
+        stops.append(UINT32_MAX);
+    }
+    LoggerSDReader reader(sd);
+    char line[64];
+    if (reader.open(indexFile().c_str())) {
+        while (reader.readLine(line, sizeof(line))) {
+            unsigned long number, seq, time, offset;
+            if (sscanf(line, "c %lu %lu %lu %lu", &number, &seq, &time, &offset) != 4) continue;
+            if (number < segments.first().number) continue;
+            int i = number - segments.first().number;
+            if (i >= segments.size()) continue;
+            if (time > 0 && time <= from) starts[i] = offset;
+            if (time > to && offset < stops[i]) stops[i] = offset;
+        }
+    }
+
+    // copy the overlapping segments
+    size_t bytes = 0;
+    for (int i = 0; i < segments.size(); i++) {
+        uint32_t start_time = segments[i].first_time;
+        uint32_t end_time = i + 1 < segments.size() ? segments[i + 1].first_time : UINT32_MAX;
+        if ((end_time > 0 && end_time < from) || start_time > to) continue;
+        if (!reader.open(segmentFile(segments[i].number).c_str(), starts[i])) continue;
+        const uint8_t* chunk;
+        size_t chunk_size;
+        uint32_t position = reader.position();
+        while (position < stops[i] && (chunk = reader.nextChunk(chunk_size)) != nullptr) {
+            size_t n = std::min((uint32_t) chunk_size, stops[i] - position);
+            bytes += out.write(chunk, n);
+            position += chunk_size;
+        }
+    }
+    Log.info("exported %d bytes from SD log '%s'", bytes, name.c_str());
+    return(bytes);
+}
+
+// info
+Variant LoggerSDLog::getInfo() {
+    Variant info;
+    info.set("segments", segments.size());
+    if (!segments.isEmpty()) {
+        info.set("first", segments.first().number);
+        info.set("current", segments.last().number);
+    }
+    info.set("bytes", segment_bytes);
+    return(info);
+}
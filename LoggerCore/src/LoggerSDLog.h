@@ -0,0 +1,78 @@
+#pragma once
+#include "Particle.h"
+#include "LoggerSD.h"
+
+/**
+ * @brief SD card log that is split into numbered segments (<name>_<n>.log) with a small index file (<name>.idx)
+ * segments rotate by size or age, retention deletes whole segments, and exports only read the segments
+ * (starting from the closest checkpoint) that overlap the requested time window
+ * index lines: "s <segment> <seq> <time>" when a segment starts and "c <segment> <seq> <time> <offset>" every
+ * checkpoint_every records (time is Time.now(), 0 if the time was not valid yet)
+ */
+class LoggerSDLog {
+
+    private:
+
+        struct Segment {
+            uint32_t number;
+            uint32_t first_seq; // sequence number of the first record
+            uint32_t first_time; // time of the first record
+        };
+
+        // index checkpoint: the record with sequence number seq starts at offset of the segment
+        struct Checkpoint {
+            uint32_t number;
+            uint32_t seq;
+            uint32_t time;
+            uint32_t offset;
+        };
+
+        LoggerSD* sd;
+        const String name; // file name base
+        const uint32_t max_bytes; // rotate once a segment has this many bytes (the current segment is streamed once to recover after a restart)
+        const uint32_t max_seconds; // rotate once a segment is this old (0 = only by size)
+        const size_t max_segments; // retention: delete the oldest segments beyond this (one per append, the index is rewritten every 1/8)
+        const uint32_t checkpoint_every = 64; // records between index checkpoints
+
+        Vector<Segment> segments; // segments on the card (oldest first)
+        Checkpoint checkpoint = {0, 0, 0, 0}; // last checkpoint (recovery after a restart validates the current segment from there)
+        uint32_t segment_bytes = 0; // bytes in the current segment
+        uint32_t records = 0; // records in the current segment since the last checkpoint
+        bool loaded = false; // whether the index was read
+        size_t deleted = 0; // segments deleted since the index was last rewritten
+
+        String segmentFile(uint32_t number);
+        String indexFile();
+        void writeIndex(const String& line);
+
+        // read the index and recover the sequence from the current segment
+        bool load();
+
+        // start a new segment
+        void rotate(uint32_t time);
+
+        // delete the oldest segment if there are more than max_segments (rewrites the index every max_segments / 8)
+        void applyRetention();
+
+    public:
+
+        // default segments of 32 KB: recovering the current segment at the first append after a restart streams it
+        // from the card once (~3 s at typical OpenLog read speeds), 256 of them keep the last 8 MB
+        LoggerSDLog(LoggerSD* sd, const String& name, uint32_t max_bytes = 32 * 1024, uint32_t max_seconds = 24 * 3600, size_t max_segments = 256) :
+            sd(sd), name(name), max_bytes(max_bytes), max_seconds(max_seconds), max_segments(max_segments) {};
+
+        // append a framed record to the current segment (rotates first if needed), call LoggerSD::syncFile() afterwards
+        bool append(const char* data);
+
+        /**
+         * @brief copy the framed records of the time window [from, to] (Time.now() values) to out,
+         * reads only the segments that overlap the window, from the last checkpoint before from to the first checkpoint after to
+         * (the card can only stream a file from the start: the bytes before the starting checkpoint are still read over the
+         * bus and dropped, checkpoints save the copying, only skipping whole segments saves bus time)
+         * returns the number of bytes copied
+         */
+        size_t exportRange(uint32_t from, uint32_t to, Print& out);
+
+        // {"segments": n, "first": oldest segment, "current": current segment, "bytes": bytes in the current segment}
+        Variant getInfo();
+};
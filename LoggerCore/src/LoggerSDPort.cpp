@@ -0,0 +1,19 @@
+#include "Particle.h"
+#include "LoggerSDPort.h"
+
+bool LoggerSDPort::queue(uint8_t reg, const uint8_t* data, size_t length) {
+    const size_t chunk = I2C_BUFFER_LENGTH - 1;
+    for (size_t i = 0; i < length; i += chunk) {
+        if (!transmit(reg, data + i, std::min(chunk, length - i))) {
+            queue_failed = true;
+            break;
+        }
+    }
+    return(true);
+}
+
+bool LoggerSDPort::flush() {
+    bool success = !queue_failed;
+    queue_failed = false;
+    return(success);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "Particle.h"
+#include "LoggerI2C.h"
+
+// Qwiic OpenLog registers (command register followed by the file name or data in the same transaction)
+namespace OpenLogRegister {
+    const uint8_t status = 0x01; // read 1 byte of status bits
+    const uint8_t create_file = 0x06; // create file
+    const uint8_t read_file = 0x09; // start streaming file, consecutive reads return its content from the start
+    const uint8_t open_file = 0x0B; // open file for appending (created if missing)
+    const uint8_t write_file = 0x0C; // append data to the open file
+    const uint8_t file_size = 0x0D; // next read returns the file size (4 bytes, big endian, -1 if missing)
+    const uint8_t remove = 0x0F; // remove file, next read returns the number of removed files (4 bytes)
+    const uint8_t sync_file = 0x11; // write the open file's buffer to the card
+
+    // status bits
+    const uint8_t status_sd_init_good = 0x01;
+    const uint8_t status_last_command_success = 0x02;
+}
+
+/**
+ * @brief transport between LoggerSD and a Qwiic OpenLog: single I2C transactions at the register level
+ * LoggerSDWirePort talks to the hardware on the I2C bus, LoggerSDEmulator emulates it on the flash file system
+ */
+class LoggerSDPort {
+
+    private:
+
+        bool queue_failed = false; // a write sent right away by queue() failed since the last flush()
+
+    public:
+
+        virtual ~LoggerSDPort() {};
+
+        // whether the device acknowledges its address
+        virtual bool ping() = 0;
+
+        // one write transaction: register followed by data (at most I2C_BUFFER_LENGTH bytes in total), returns whether it was acknowledged
+        virtual bool transmit(uint8_t reg, const uint8_t* data = nullptr, size_t length = 0) = 0;
+
+        // one read transaction (at most I2C_BUFFER_LENGTH bytes), returns the number of bytes received
+        virtual size_t receive(uint8_t* data, size_t length) = 0;
+
+        // deferred writes of any length (sent right away unless the port queues them), returns false and defers
+        // nothing if the port's queue is full (flush() first), failed writes are reported by flush()
+        virtual bool queue(uint8_t reg, const uint8_t* data, size_t length);
+
+        // send all deferred writes, returns false if any of them failed since the last flush()
+        virtual bool flush();
+
+        // switch the bus clock, returns false (and keeps the previous clock) if a device stopped responding
+        virtual bool setClockSpeed(uint32_t speed) = 0;
+
+        // current bus clock
+        virtual uint32_t getClockSpeed() = 0;
+};
+
+// Qwiic OpenLog on the shared I2C bus (LoggerI2C), writes are queued and sent from LoggerI2C::loop() until flush()
+class LoggerSDWirePort : public LoggerSDPort {
+
+    private:
+
+        LoggerI2CDevice device;
+
+    public:
+
+        LoggerSDWirePort(uint8_t address) : device(address, "sd") {};
+
+        // the cached device map from the first bus scan, afterwards a single address rescan
+        bool ping() override { return(device.isPresent() || device.probe()); };
+        bool transmit(uint8_t reg, const uint8_t* data = nullptr, size_t length = 0) override { return(device.write(reg, data, length)); };
+        size_t receive(uint8_t* data, size_t length) override { return(device.read(data, length)); };
+        bool queue(uint8_t reg, const uint8_t* data, size_t length) override { return(device.queue(reg, data, length)); };
+        bool flush() override { return(device.flush()); };
+        bool setClockSpeed(uint32_t speed) override { return(LoggerI2C::setClockSpeed(speed)); };
+        uint32_t getClockSpeed() override { return(LoggerI2C::clock_speed); };
+};
@@ -0,0 +1,489 @@
+#include "Particle.h"
+#include "LoggerStorage.h"
+#include "LoggerPlatform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// tier metrics
+Variant LoggerStorageTier::getMetrics() {
+    Variant metrics;
+    metrics.set("cap", getCapacity());
+    metrics.set("used", getUsed());
+    metrics.set("size", getFootprint());
+    metrics.set("%", getCapacity() > 0 ? 100.0f * getFootprint() / getCapacity() : NAN);
+    metrics.set("in", in);
+    metrics.set("in_Bps", in_us > 0 ? in_bytes * 1e6f / in_us : NAN);
+    metrics.set("out", out);
+    metrics.set("out_Bps", out_us > 0 ? out_bytes * 1e6f / out_us : NAN);
+    if (!available()) metrics.set("na", true);
+    return(metrics);
+}
+
+// RAM tier
+bool LoggerStorageRAM::append(const String& record) {
+    records.push_back(record);
+    used += record.length() + 1;
+    return(true);
+}
+
+bool LoggerStorageRAM::peek(String& record) {
+    if (records.empty()) return(false);
+    record = records.front();
+    return(true);
+}
+
+bool LoggerStorageRAM::pop() {
+    if (records.empty()) return(false);
+    used -= records.front().length() + 1;
+    records.pop_front();
+    return(true);
+}
+
+// flash tier
+String LoggerStorageFlash::getSegmentFile(uint32_t segment) {
+    return(String::format("%s/warm_%lu.dat", dir.c_str(), segment));
+}
+
+#if HAL_PLATFORM_FILESYSTEM
+
+LoggerStorageFlash::~LoggerStorageFlash() {
+    if (read_fd >= 0) close(read_fd);
+    if (write_fd >= 0) close(write_fd);
+    if (cursor_fd >= 0) close(cursor_fd);
+}
+
+bool LoggerStorageFlash::begin() {
+    if (capacity == 0) return(false);
+    mkdir(dir.c_str(), 0777);
+    cursor_fd = open((dir + "/warm.cur").c_str(), O_RDWR | O_CREAT, 0666);
+    if (cursor_fd < 0) {
+        Log.error("cannot open the flash storage tier in '%s'", dir.c_str());
+        return(false);
+    }
+    Cursor saved;
+    if (read(cursor_fd, &saved, sizeof(saved)) == sizeof(saved) && saved.read_segment <= saved.write_segment) cursor = saved;
+
+    // segment that was read but not yet deleted before a restart
+    struct stat info;
+    if (cursor.read_segment > 0 && stat(getSegmentFile(cursor.read_segment - 1).c_str(), &info) == 0) {
+        unlink(getSegmentFile(cursor.read_segment - 1).c_str());
+        LoggerPlatform::trackFlashDelete(info.st_size);
+    }
+
+    // segments
+    footprint = 0;
+    for (uint32_t segment = cursor.read_segment; segment < cursor.write_segment; segment++) {
+        if (stat(getSegmentFile(segment).c_str(), &info) == 0) footprint += info.st_size;
+    }
+    write_fd = open(getSegmentFile(cursor.write_segment).c_str(), O_RDWR | O_CREAT, 0666);
+    if (write_fd < 0) {
+        Log.error("cannot open the flash storage tier in '%s'", dir.c_str());
+        close(cursor_fd);
+        cursor_fd = -1;
+        return(false);
+    }
+    write_bytes = lseek(write_fd, 0, SEEK_END);
+    footprint += write_bytes;
+    openReadSegment();
+    if (cursor.offset > getReadBytes()) cursor.offset = 0;
+    if (getUsed() > 0) Log.info("flash storage tier has %u bytes of records in %lu segments", getUsed(), cursor.write_segment - cursor.read_segment + 1);
+    return(true);
+}
+
+void LoggerStorageFlash::saveCursor() {
+    lseek(cursor_fd, 0, SEEK_SET);
+    write(cursor_fd, &cursor, sizeof(cursor));
+    fsync(cursor_fd);
+}
+
+void LoggerStorageFlash::openReadSegment() {
+    read_fd = -1;
+    read_bytes = 0;
+    if (cursor.read_segment == cursor.write_segment) return;
+    read_fd = open(getSegmentFile(cursor.read_segment).c_str(), O_RDONLY);
+    if (read_fd >= 0) read_bytes = lseek(read_fd, 0, SEEK_END);
+}
+
+bool LoggerStorageFlash::rotate() {
+    if (cursor.read_segment == cursor.write_segment) {
+        // still being read: keep it open for reading
+        read_fd = write_fd;
+        read_bytes = write_bytes;
+    } else {
+        close(write_fd);
+    }
+    cursor.write_segment++;
+    saveCursor();
+    write_fd = open(getSegmentFile(cursor.write_segment).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    write_bytes = 0;
+    if (write_fd < 0) Log.error("cannot open flash storage segment %lu", cursor.write_segment);
+    return(write_fd >= 0);
+}
+
+void LoggerStorageFlash::nextSegment() {
+    if (read_fd >= 0) close(read_fd);
+    String file = getSegmentFile(cursor.read_segment);
+    uint32_t bytes = read_bytes;
+    cursor.read_segment++;
+    cursor.offset = 0;
+    // cursor first so the deleted segment is never read again (begin() deletes it if a restart comes in between)
+    saveCursor();
+    unlink(file.c_str());
+    LoggerPlatform::trackFlashDelete(bytes);
+    footprint -= std::min(footprint, (size_t) bytes);
+    openReadSegment();
+}
+
+bool LoggerStorageFlash::append(const String& record) {
+    if (write_fd < 0) return(false);
+    if (write_bytes >= segment_size && !rotate()) return(false);
+    lseek(write_fd, 0, SEEK_END);
+    size_t length = record.length();
+    bool success = write(write_fd, record.c_str(), length) == (ssize_t) length && write(write_fd, "\n", 1) == 1 && fsync(write_fd) == 0;
+    if (!success) {
+        // drop a partial record
+        ftruncate(write_fd, write_bytes);
+        fsync(write_fd);
+        return(false);
+    }
+    LoggerPlatform::trackFlashWrite(write_bytes, write_bytes + length + 1);
+    write_bytes += length + 1;
+    footprint += length + 1;
+    return(true);
+}
+
+bool LoggerStorageFlash::peek(String& record) {
+    record = "";
+    peeked_bytes = 0;
+    // segments that were read completely
+    while (cursor.offset >= getReadBytes() && cursor.read_segment != cursor.write_segment) nextSegment();
+    int fd = getReadFd();
+    if (fd < 0 || cursor.offset >= getReadBytes()) return(false);
+    lseek(fd, cursor.offset, SEEK_SET);
+    char chunk[64];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            peeked_bytes++;
+            if (chunk[i] == '\n') return(true);
+            record += chunk[i];
+        }
+    }
+    // last record without line end
+    return(peeked_bytes > 0);
+}
+
+bool LoggerStorageFlash::pop() {
+    if (peeked_bytes == 0) {
+        String record;
+        if (!peek(record)) return(false);
+    }
+    cursor.offset += peeked_bytes;
+    peeked_bytes = 0;
+    if (cursor.offset >= getReadBytes()) {
+        if (cursor.read_segment != cursor.write_segment) {
+            // older segment read: delete it (saves the cursor)
+            nextSegment();
+            return(true);
+        }
+        // all read: start over
+        ftruncate(write_fd, 0);
+        fsync(write_fd);
+        LoggerPlatform::trackFlashWrite(write_bytes, 0);
+        write_bytes = 0;
+        footprint = 0;
+        cursor.offset = 0;
+    }
+    saveCursor();
+    return(true);
+}
+
+#else
+
+// no flash file system: the tier is never available
+LoggerStorageFlash::~LoggerStorageFlash() {}
+bool LoggerStorageFlash::begin() { return(false); }
+void LoggerStorageFlash::saveCursor() {}
+void LoggerStorageFlash::openReadSegment() {}
+bool LoggerStorageFlash::rotate() { return(false); }
+void LoggerStorageFlash::nextSegment() {}
+bool LoggerStorageFlash::append(const String& record) { return(false); }
+bool LoggerStorageFlash::peek(String& record) { return(false); }
+bool LoggerStorageFlash::pop() { return(false); }
+
+#endif
+
+// SD tier
+String LoggerStorageSD::getSegmentFile(uint32_t segment) {
+    return(String::format("%s%lu.dat", name.c_str(), segment));
+}
+
+bool LoggerStorageSD::check() {
+    if (!available()) return(false);
+    if (checked) return(true);
+
+    // segment range from the index (no index: segment 0 only)
+    first = 0;
+    last = 0;
+    cursor = 0;
+    String index = name + ".idx";
+    if (sd->size(index) > 0) {
+        LoggerSDReader index_reader(sd);
+        String line;
+        unsigned long index_first, index_last;
+        if (index_reader.open(index.c_str()) && index_reader.readLine(line) &&
+                sscanf(line.c_str(), "%lu %lu", &index_first, &index_last) == 2 && index_first <= index_last) {
+            first = index_first;
+            last = index_last;
+        }
+    }
+    first_bytes = std::max(sd->size(getSegmentFile(first)), (int32_t) 0);
+    last_bytes = std::max(sd->size(getSegmentFile(last)), (int32_t) 0);
+    if (!available()) return(false);
+
+    // the segments in between are full (estimated rather than checked one by one so this stays quick on a full tier)
+    footprint = first == last ? last_bytes : first_bytes + (last - first - 1) * segment_size + last_bytes;
+    checked = true;
+    if (footprint > 0) Log.info("SD storage tier has ~%u bytes of records in %lu segments", footprint, last - first + 1);
+    return(true);
+}
+
+void LoggerStorageSD::saveIndex() {
+    // rewritten (the card only appends), no index means segment 0 only
+    String index = name + ".idx";
+    sd->removeFile(index);
+    if (last == 0) return;
+    if (sd->append(index)) {
+        sd->printf("%lu %lu\n", first, last);
+        sd->syncFile();
+    }
+}
+
+void LoggerStorageSD::nextSegment() {
+    sd->removeFile(getSegmentFile(first));
+    footprint -= std::min(footprint, (size_t) first_bytes);
+    first++;
+    cursor = 0;
+    if (first == last) {
+        first_bytes = 0;
+        footprint = last_bytes;
+    } else {
+        first_bytes = std::max(sd->size(getSegmentFile(first)), (int32_t) 0);
+    }
+    saveIndex();
+}
+
+bool LoggerStorageSD::append(const String& record) {
+    if (!check()) return(false);
+    if (last_bytes >= segment_size) {
+        // segment full: continue in a new one
+        if (first == last) first_bytes = last_bytes;
+        last++;
+        last_bytes = 0;
+        saveIndex();
+    }
+    if (!sd->append(getSegmentFile(last))) return(false);
+    sd->print(record);
+    sd->write('\n');
+    if (!sd->syncFile()) return(false);
+    last_bytes += record.length() + 1;
+    footprint += record.length() + 1;
+    return(true);
+}
+
+bool LoggerStorageSD::peek(String& record) {
+    if (peeked_bytes > 0) {
+        record = peeked;
+        return(true);
+    }
+    if (!check()) return(false);
+    // segments that were read completely
+    while (cursor >= getFirstBytes() && first < last) nextSegment();
+    if (cursor >= getFirstBytes()) return(false);
+    // (re-)open the stream at the cursor if it was ended by other file commands
+    if (reader_segment != first || reader.eof() || reader.interrupted() || reader.position() != cursor) {
+        if (!reader.open(getSegmentFile(first).c_str(), cursor)) return(false);
+        reader_segment = first;
+    }
+    if (!reader.readLine(peeked)) return(false);
+    peeked_bytes = reader.position() - cursor;
+    record = peeked;
+    return(true);
+}
+
+bool LoggerStorageSD::pop() {
+    if (peeked_bytes == 0) {
+        String record;
+        if (!peek(record)) return(false);
+    }
+    cursor += peeked_bytes;
+    peeked_bytes = 0;
+    peeked = "";
+    if (cursor >= getFirstBytes()) {
+        if (first < last) {
+            // older segment read: remove it
+            nextSegment();
+        } else {
+            // all read: start over at segment 0
+            sd->removeFile(getSegmentFile(first));
+            if (first > 0) {
+                first = 0;
+                last = 0;
+                saveIndex();
+            }
+            first_bytes = 0;
+            last_bytes = 0;
+            footprint = 0;
+            cursor = 0;
+        }
+    }
+    return(true);
+}
+
+// storage
+void LoggerStorage::setup() {
+    if (warm.begin()) {
+        Log.info("storage tiers: %u bytes RAM, %u bytes flash", hot.getCapacity(), warm.getCapacity());
+    } else {
+        Log.info("storage tiers: %u bytes RAM, no flash", hot.getCapacity());
+    }
+}
+
+bool LoggerStorage::write(size_t tier, const String& record) {
+    unsigned long start = micros();
+    bool success = tiers[tier]->append(record);
+    tiers[tier]->in_us += micros() - start;
+    if (success) {
+        tiers[tier]->in++;
+        tiers[tier]->in_bytes += record.length() + 1;
+    }
+    return(success);
+}
+
+bool LoggerStorage::read(size_t tier, String& record) {
+    unsigned long start = micros();
+    bool success = tiers[tier]->peek(record);
+    tiers[tier]->out_us += micros() - start;
+    if (success) {
+        tiers[tier]->out++;
+        tiers[tier]->out_bytes += record.length() + 1;
+    }
+    return(success);
+}
+
+bool LoggerStorage::demote(size_t tier, bool drop) {
+    String record;
+    if (!read(tier, record)) return(false);
+    size_t bytes = record.length() + 1;
+
+    // next available tier (make room there first if needed)
+    for (size_t next = tier + 1; next < n_tiers; next++) {
+        if (!tiers[next]->available()) continue;
+        if (!tiers[next]->hasRoom(bytes) && next + 1 < n_tiers) demote(next, drop);
+        if (tiers[next]->hasRoom(bytes) && write(next, record)) {
+            if (tier == peeked_tier) peeked_tier = n_tiers;
+            tiers[tier]->pop();
+            demoted++;
+            return(true);
+        }
+    }
+
+    // no room anywhere
+    if (!drop) return(false);
+    if (tier == peeked_tier) peeked_tier = n_tiers;
+    tiers[tier]->pop();
+    dropped++;
+    Log.warn("storage full, dropped the oldest record of the %s tier (%u bytes)", tiers[tier]->getName(), bytes);
+    return(true);
+}
+
+bool LoggerStorage::promote(size_t tier) {
+    String record;
+    if (!read(tier, record)) return(false);
+    if (!hot.hasRoom(record.length() + 1) || !write(0, record)) return(false);
+    if (tier == peeked_tier) peeked_tier = n_tiers;
+    tiers[tier]->pop();
+    promoted++;
+    return(true);
+}
+
+size_t LoggerStorage::nextTier() {
+    for (size_t i = 0; i < n_tiers; i++) {
+        if (tiers[i]->available() && !tiers[i]->isEmpty()) return(i);
+    }
+    return(n_tiers);
+}
+
+bool LoggerStorage::underPressure() {
+    return(LoggerPlatform::getSampledFreeHeap() < ram_reserve);
+}
+
+bool LoggerStorage::append(const String& record) {
+    size_t bytes = record.length() + 1;
+    // make room in RAM
+    while (!hot.hasRoom(bytes) && !hot.isEmpty()) demote(0);
+    if (hot.hasRoom(bytes)) return(write(0, record));
+    // larger than the RAM tier: straight into the next tier with room
+    for (size_t next = 1; next < n_tiers; next++) {
+        if (tiers[next]->available() && tiers[next]->hasRoom(bytes) && write(next, record)) return(true);
+    }
+    dropped++;
+    Log.error("record (%u bytes) does not fit into any storage tier, dropped", bytes);
+    return(false);
+}
+
+bool LoggerStorage::peek(String& record) {
+    peeked_tier = nextTier();
+    if (peeked_tier == n_tiers) return(false);
+    return(read(peeked_tier, record));
+}
+
+bool LoggerStorage::pop() {
+    if (peeked_tier == n_tiers) return(false);
+    bool popped = tiers[peeked_tier]->pop();
+    peeked_tier = n_tiers;
+    return(popped);
+}
+
+void LoggerStorage::loop(bool connected) {
+    // demote from RAM under memory pressure: the sampled values only change every few seconds, so a low sample
+    // demotes at most one batch per loop() and only while the live free memory is still below the reserve, a low
+    // memory forecast demotes one batch per heap sample, records are only moved (never dropped) for this
+    size_t forecast_batch = 0;
+    if (LoggerPlatform::heap_low && LoggerPlatform::heap_last_sampled != pressure_sampled) {
+        pressure_sampled = LoggerPlatform::heap_last_sampled;
+        forecast_batch = demote_batch;
+    }
+    bool pressure = underPressure();
+    for (size_t i = 0; i < demote_batch && !hot.isEmpty(); i++) {
+        if (i >= forecast_batch && !(pressure && System.freeMemory() < ram_reserve)) break;
+        if (!demote(0, false)) break; // no tier can take it, keep it in RAM
+    }
+
+    // promote to RAM while connected (only with twice the reserve free so it does not cause demotion again)
+    if (!connected) return;
+    for (size_t i = 0; i < promote_batch && !LoggerPlatform::heap_low && LoggerPlatform::getSampledFreeHeap() > 2 * ram_reserve; i++) {
+        size_t tier = nextTier();
+        if (tier == 0) {
+            // RAM has records, promote from the next tier that has records
+            tier = n_tiers;
+            for (size_t j = 1; j < n_tiers && tier == n_tiers; j++) {
+                if (tiers[j]->available() && !tiers[j]->isEmpty()) tier = j;
+            }
+        }
+        if (tier == n_tiers || !promote(tier)) break;
+    }
+}
+
+Variant LoggerStorage::getMetrics() {
+    Variant metrics;
+    for (size_t i = 0; i < n_tiers; i++) metrics.set(tiers[i]->getName(), tiers[i]->getMetrics());
+    metrics.set("demoted", demoted);
+    metrics.set("promoted", promoted);
+    metrics.set("dropped", dropped);
+    return(metrics);
+}
@@ -0,0 +1,265 @@
+#pragma once
+#include "Particle.h"
+#include <deque>
+#include "LoggerSD.h"
+#include "LoggerPlatformTraits.h"
+
+/**
+ * @brief one storage tier: an append-only queue of records (one line of text each, e.g. a burst's JSON)
+ * with a read cursor at the oldest record (peek() it, pop() it once it is handled)
+ */
+class LoggerStorageTier {
+
+    public:
+
+        // throughput counters (updated by LoggerStorage)
+        uint32_t in = 0; // records appended
+        uint32_t in_bytes = 0;
+        uint32_t in_us = 0; // time spent appending
+        uint32_t out = 0; // records read
+        uint32_t out_bytes = 0;
+        uint32_t out_us = 0; // time spent reading
+
+        virtual ~LoggerStorageTier() {};
+
+        virtual const char* getName() = 0;
+
+        // whether the tier can be used right now
+        virtual bool available() = 0;
+
+        // bytes the tier can hold and bytes held (records not popped yet)
+        virtual size_t getCapacity() = 0;
+        virtual size_t getUsed() = 0;
+
+        // bytes the tier takes up on its medium (popped records included until their space is reclaimed)
+        virtual size_t getFootprint() { return(getUsed()); };
+
+        // append a record at the end
+        virtual bool append(const String& record) = 0;
+
+        // oldest record (stays at the cursor until pop())
+        virtual bool peek(String& record) = 0;
+
+        // move the cursor past the oldest record
+        virtual bool pop() = 0;
+
+        bool isEmpty() { return(getUsed() == 0); };
+        bool hasRoom(size_t bytes) { return(getFootprint() + bytes <= getCapacity()); };
+
+        /**
+         * @brief capacity, occupancy and throughput (bytes/s while appending/reading), e.g.
+         * {"cap": 10240, "used": 2380, "size": 3120, "%": 30.5, "in": 12, "in_Bps": 51200, "out": 3, "out_Bps": 98000}
+         * (% is the size, i.e. footprint, relative to the capacity)
+         */
+        Variant getMetrics();
+};
+
+// hot tier: records in RAM
+class LoggerStorageRAM : public LoggerStorageTier {
+
+    private:
+
+        std::deque<String> records;
+        size_t used = 0;
+        const size_t capacity;
+
+    public:
+
+        LoggerStorageRAM(size_t capacity = LoggerPlatformTraits::storage_hot_size) : capacity(capacity) {};
+
+        const char* getName() override { return("ram"); };
+        bool available() override { return(true); };
+        size_t getCapacity() override { return(capacity); };
+        size_t getUsed() override { return(used); };
+        bool append(const String& record) override;
+        bool peek(String& record) override;
+        bool pop() override;
+};
+
+/**
+ * @brief warm tier: records in segment files on the flash file system (<dir>/warm_<n>.dat, each up to 1/8 of the capacity),
+ * the read position and the segment being written are kept in <dir>/warm.cur so the records survive restarts,
+ * every write is synced and a segment is deleted once all its records are read
+ */
+class LoggerStorageFlash : public LoggerStorageTier {
+
+    private:
+
+        // read position (segment and offset) and segment being written (persisted in <dir>/warm.cur)
+        struct Cursor {
+            uint32_t read_segment = 0;
+            uint32_t offset = 0;
+            uint32_t write_segment = 0;
+        };
+
+        const String dir;
+        const size_t capacity;
+        const size_t segment_size; // a new segment is started once the one being written reaches this size
+        Cursor cursor;
+        int cursor_fd = -1;
+        int write_fd = -1; // segment being written (also read from while it is the read segment)
+        uint32_t write_bytes = 0;
+        int read_fd = -1; // segment being read if it is an older one
+        uint32_t read_bytes = 0;
+        size_t footprint = 0; // bytes in all segments
+        uint32_t peeked_bytes = 0; // bytes of the last peeked record (including the line end), 0 if none
+
+        String getSegmentFile(uint32_t segment);
+        int getReadFd() { return(cursor.read_segment == cursor.write_segment ? write_fd : read_fd); };
+        uint32_t getReadBytes() { return(cursor.read_segment == cursor.write_segment ? write_bytes : read_bytes); };
+        void saveCursor();
+
+        // open the read segment if it is an older one
+        void openReadSegment();
+
+        // continue in a new segment once the one being written is full
+        bool rotate();
+
+        // delete the read segment (all read) and continue reading the next one
+        void nextSegment();
+
+    public:
+
+        LoggerStorageFlash(const char* dir = "/logger", size_t capacity = LoggerPlatformTraits::storage_warm_size) :
+            dir(dir), capacity(capacity), segment_size(std::max(capacity / 8, (size_t) 1024)) {};
+        ~LoggerStorageFlash();
+
+        // open the files (and restore the cursor)
+        bool begin();
+
+        const char* getName() override { return("flash"); };
+        bool available() override { return(write_fd >= 0); };
+        size_t getCapacity() override { return(capacity); };
+        size_t getUsed() override { return(footprint - cursor.offset); };
+        size_t getFootprint() override { return(footprint); };
+        bool append(const String& record) override;
+        bool peek(String& record) override;
+        bool pop() override;
+};
+
+/**
+ * @brief cold tier: records in segment files on the SD card (<name><n>.dat, 8 KB each by default) whose range is listed
+ * in <name>.idx, a segment is removed once all its records are read, the read position is only kept in RAM (after a
+ * restart the records still on the card are read again) and reading re-streams the segment up to the read position
+ * whenever another file command ended the read stream (the card can only stream from the start, so at most one segment)
+ */
+class LoggerStorageSD : public LoggerStorageTier {
+
+    private:
+
+        LoggerSD* sd;
+        const String name;
+        const size_t capacity;
+        const size_t segment_size; // a new segment is started once the one being written reaches this size
+        bool checked = false; // whether the segments were checked on the card
+        uint32_t first = 0; // segment being read
+        uint32_t last = 0; // segment being written
+        uint32_t cursor = 0; // read position in the first segment
+        uint32_t first_bytes = 0; // bytes in the first segment (if it is not also the last)
+        uint32_t last_bytes = 0; // bytes in the last segment
+        size_t footprint = 0; // bytes in all segments
+        LoggerSDReader reader;
+        uint32_t reader_segment = 0; // segment the reader has open
+        String peeked; // last peeked record
+        uint32_t peeked_bytes = 0; // its bytes (including the line end), 0 if none
+
+        String getSegmentFile(uint32_t segment);
+        uint32_t getFirstBytes() { return(first == last ? last_bytes : first_bytes); };
+
+        // check the segments once the card is available
+        bool check();
+
+        // record the segment range in the index file
+        void saveIndex();
+
+        // remove the first segment (all read) and continue reading the next one
+        void nextSegment();
+
+    public:
+
+        LoggerStorageSD(LoggerSD* sd, const char* name = "cold", size_t capacity = 64 * LoggerPlatformTraits::MB, size_t segment_size = 8 * LoggerPlatformTraits::KB) :
+            sd(sd), name(name), capacity(capacity), segment_size(segment_size), reader(sd) {};
+
+        const char* getName() override { return("sd"); };
+        bool available() override { return(sd != nullptr && sd->available()); };
+        size_t getCapacity() override { return(capacity); };
+        size_t getUsed() override { return(footprint - cursor); };
+        size_t getFootprint() override { return(footprint); };
+        bool append(const String& record) override;
+        bool peek(String& record) override;
+        bool pop() override;
+};
+
+/**
+ * @brief tiered record storage: RAM (hot), flash (warm) and SD card (cold) behind one append/peek/pop interface
+ * new records go into RAM, the oldest records are demoted to the next available tier when RAM is full (and from
+ * flash to SD when flash is full, the oldest records are dropped if no tier has room) or in batches when memory
+ * runs low (only while a tier has room, under memory pressure records stay in RAM rather than being dropped),
+ * records are promoted back to RAM while connected, and peek()/pop() read from the fastest tier that has records
+ * (so records are not necessarily read in the order they were appended)
+ */
+class LoggerStorage {
+
+    private:
+
+        LoggerStorageRAM hot;
+        LoggerStorageFlash warm;
+        LoggerStorageSD cold;
+        static const size_t n_tiers = 3;
+        LoggerStorageTier* tiers[n_tiers] = {&hot, &warm, &cold};
+
+        const size_t ram_reserve; // demote from RAM when free memory drops below this
+        const size_t promote_batch = 4; // records promoted per loop()
+        const size_t demote_batch = 4; // records demoted per loop() under memory pressure
+        unsigned long pressure_sampled = 0; // heap sample (LoggerPlatform::heap_last_sampled) of the last forecast batch
+        size_t peeked_tier = n_tiers; // tier of the last peek() (n_tiers if none)
+
+        // counters
+        uint32_t demoted = 0;
+        uint32_t promoted = 0;
+        uint32_t dropped = 0;
+
+        // timed tier access (throughput metrics)
+        bool write(size_t tier, const String& record);
+        bool read(size_t tier, String& record);
+
+        // move the oldest record of a tier to the next available tier, if there is no room anywhere it is dropped
+        // (or kept and false returned if !drop)
+        bool demote(size_t tier, bool drop = true);
+
+        // move the oldest record of a tier to RAM
+        bool promote(size_t tier);
+
+        // fastest tier with records (n_tiers if none)
+        size_t nextTier();
+
+        // memory pressure: free memory (as last sampled by LoggerPlatform) below the reserve
+        bool underPressure();
+
+    public:
+
+        LoggerStorage(LoggerSD* sd, size_t ram_reserve) : cold(sd), ram_reserve(ram_reserve) {};
+
+        // open the flash tier
+        void setup();
+
+        // append a record
+        bool append(const String& record);
+
+        // oldest record of the fastest tier that has records
+        bool peek(String& record);
+
+        // remove the record returned by the last peek(), returns false if it was demoted/promoted in the meantime
+        // (it is then read again from its new tier)
+        bool pop();
+
+        bool isEmpty() { return(nextTier() == n_tiers); };
+
+        // demotes under memory pressure, promotes while connected
+        void loop(bool connected);
+
+        /**
+         * @brief metrics of each tier (see LoggerStorageTier::getMetrics()) plus demotion/promotion/drop counts
+         */
+        Variant getMetrics();
+};
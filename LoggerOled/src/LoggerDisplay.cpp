@@ -0,0 +1,220 @@
+#include "Particle.h"
+#include "LoggerDisplay.h"
+
+// panel
+bool LoggerDisplay::command(const uint8_t* commands, size_t length) {
+    // control byte 0x00: the rest of the transaction are commands
+    return(device.write(0x00, commands, length));
+}
+
+bool LoggerDisplay::begin() {
+    if (reset_pin >= 0) {
+        pinMode(reset_pin, OUTPUT);
+        digitalWrite(reset_pin, HIGH);
+        delay(1);
+        digitalWrite(reset_pin, LOW);
+        delay(10);
+        digitalWrite(reset_pin, HIGH);
+    }
+    if (!device.probe()) {
+        Log.error("no OLED display found at I2C address 0x%02X", device.getAddress());
+        return(false);
+    }
+
+    // 128x64 with internal charge pump, horizontal addressing
+    const uint8_t init[] = {
+        0xAE,       // display off
+        0xD5, 0x80, // clock divide
+        0xA8, 0x3F, // multiplex (64 rows)
+        0xD3, 0x00, // display offset
+        0x40,       // start line 0
+        0x8D, 0x14, // charge pump on
+        0x20, 0x00, // horizontal addressing
+        0xA1,       // segment remap
+        0xC8,       // COM scan direction
+        0xDA, 0x12, // COM pins
+        0x81, 0xCF, // contrast
+        0xD9, 0xF1, // precharge
+        0xDB, 0x40, // VCOMH
+        0xA4,       // show RAM
+        0xA6,       // normal (not inverted)
+        0x2E,       // no scrolling
+        0xAF        // display on
+    };
+    if (!command(init, sizeof(init))) {
+        Log.error("OLED display failed to initialize");
+        return(false);
+    }
+    return(fullRefresh());
+}
+
+// drawing
+void LoggerDisplay::markDirty(size_t page, int16_t from, int16_t to) {
+    if (from < dirty_min[page]) dirty_min[page] = from;
+    if (to > dirty_max[page]) dirty_max[page] = to;
+    frame_pending = true;
+}
+
+void LoggerDisplay::markClean() {
+    for (size_t page = 0; page < pages; page++) {
+        dirty_min[page] = width_px;
+        dirty_max[page] = -1;
+    }
+}
+
+void LoggerDisplay::markUnknown() {
+    unknown_pages = 0xFF;
+    for (size_t page = 0; page < pages; page++) markDirty(page, 0, width_px - 1);
+}
+
+void LoggerDisplay::drawPixel(int16_t x, int16_t y, uint16_t color) {
+    if (x < 0 || x >= width() || y < 0 || y >= height()) return;
+    switch (getRotation()) {
+        case 1:
+            std::swap(x, y);
+            x = WIDTH - x - 1;
+            break;
+        case 2:
+            x = WIDTH - x - 1;
+            y = HEIGHT - y - 1;
+            break;
+        case 3:
+            std::swap(x, y);
+            y = HEIGHT - y - 1;
+            break;
+    }
+    size_t page = y / 8;
+    uint8_t& byte = frame[x + page * width_px];
+    uint8_t bit = 1 << (y & 7);
+    uint8_t value = color == WHITE ? (byte | bit) : color == INVERSE ? (byte ^ bit) : (byte & ~bit);
+    if (value != byte) {
+        byte = value;
+        markDirty(page, x, x);
+    }
+}
+
+void LoggerDisplay::fillScreen(uint16_t color) {
+    uint8_t value = color == WHITE ? 0xFF : 0x00;
+    for (size_t page = 0; page < pages; page++) {
+        uint8_t* row = frame + page * width_px;
+        for (int16_t x = 0; x < width_px; x++) {
+            uint8_t byte = color == INVERSE ? ~row[x] : value;
+            if (row[x] != byte) {
+                row[x] = byte;
+                markDirty(page, x, x);
+            }
+        }
+    }
+}
+
+// updates
+size_t LoggerDisplay::sendRegion(size_t first, size_t last, int16_t from, int16_t to) {
+    // (a single page or whole pages, so the bytes are contiguous in the frame)
+    unsigned long start = micros();
+    const uint8_t address[] = {0x21, (uint8_t) from, (uint8_t) to, 0x22, (uint8_t) first, (uint8_t) last};
+    bool success = command(address, sizeof(address));
+    size_t offset = from + first * width_px;
+    size_t n = (last - first) * width_px + (to - from + 1);
+    const size_t chunk = I2C_BUFFER_LENGTH - 1;
+    for (size_t i = 0; i < n && success; i += chunk) {
+        // control byte 0x40: the rest of the transaction is display data
+        success = device.write(0x40, frame + offset + i, std::min(chunk, n - i));
+    }
+    if (success) {
+        memcpy(shadow + offset, frame + offset, n);
+    } else {
+        Log.error("sending to the OLED display failed");
+        markUnknown(); // the panel content is unknown, resend every page
+    }
+    frame_us += micros() - start;
+    frame_bytes += regionBytes(n);
+    return(success ? regionBytes(n) : 0);
+}
+
+bool LoggerDisplay::isDirty() {
+    if (unknown_pages != 0) return(true);
+    for (size_t page = 0; page < pages; page++) {
+        if (dirty_min[page] <= dirty_max[page]) return(true);
+    }
+    return(false);
+}
+
+size_t LoggerDisplay::update(size_t budget) {
+    // panel content unknown (not sent yet or a failed transaction): skipped while the panel does not respond
+    if (unknown_pages != 0 && !device.isPresent()) return(0);
+
+    size_t sent = 0;
+    for (size_t page = 0; page < pages; page++) {
+        int16_t from = dirty_min[page], to = dirty_max[page];
+        if (from > to) continue;
+
+        // only what differs from the panel (all of a page whose panel content is unknown)
+        bool unknown = unknown_pages & (1 << page);
+        const uint8_t* f = frame + page * width_px;
+        const uint8_t* s = shadow + page * width_px;
+        while (!unknown && from <= to && f[from] == s[from]) from++;
+        while (!unknown && to >= from && f[to] == s[to]) to--;
+        if (from > to) {
+            dirty_min[page] = width_px;
+            dirty_max[page] = -1;
+            continue;
+        }
+
+        // as many columns as fit into the rest of the budget
+        int16_t n = to - from + 1;
+        while (n > 0 && regionBytes(n) > budget - sent) n--;
+        if (n == 0) break;
+        size_t region = sendRegion(page, page, from, from + n - 1);
+        if (region == 0) return(sent); // failed (the next updates resend every page)
+        sent += region;
+        dirty_min[page] = from + n;
+        dirty_max[page] = from + n <= to ? to : -1;
+        if (from + n <= to) break; // budget used up
+        if (unknown) unknown_pages &= ~(1 << page); // sent whole
+    }
+
+    // frame complete
+    if (frame_pending && !isDirty()) {
+        frames++;
+        bytes += frame_bytes;
+        bytes_full += regionBytes(frame_size);
+        total_us += frame_us;
+        frame_bytes = 0;
+        frame_us = 0;
+        frame_pending = false;
+    }
+    return(sent);
+}
+
+void LoggerDisplay::display() {
+    // an unlimited update sends all changes at once, so only a failed transaction needs another pass
+    for (size_t pass = 0; pass < 2 && isDirty(); pass++) {
+        if (update(SIZE_MAX) == 0) break;
+    }
+}
+
+bool LoggerDisplay::fullRefresh() {
+    uint32_t previous_us = frame_us;
+    uint32_t previous_bytes = frame_bytes;
+    unknown_pages = 0;
+    bool success = sendRegion(0, pages - 1, 0, width_px - 1) > 0;
+    full_us = frame_us - previous_us;
+    // the full refresh is the baseline, not counted as a frame
+    frame_us = previous_us;
+    frame_bytes = previous_bytes;
+    if (!success) return(false);
+    markClean();
+    frame_pending = false;
+    return(true);
+}
+
+Variant LoggerDisplay::getMetrics() {
+    Variant metrics;
+    metrics.set("frames", frames);
+    metrics.set("B", bytes);
+    metrics.set("B_full_est", bytes_full);
+    metrics.set("B_saved_est", bytes_full - bytes);
+    metrics.set("us", frames > 0 ? total_us / frames : 0);
+    metrics.set("us_full_est", full_us);
+    return(metrics);
+}
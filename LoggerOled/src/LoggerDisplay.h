@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Particle.h"
+#include "LoggerFunction.h"
+#include "LoggerModule.h"
+#include "LoggerI2C.h"
+
+// graphics library for drawing text and shapes into the frame buffer
+// dependencies.Adafruit_GFX_RK=1.11.10
+#include "Adafruit_GFX.h"
+
+// colors
+#ifndef BLACK
+#define BLACK 0
+#define WHITE 1
+#define INVERSE 2
+#endif
+
+/**
+ * @brief 128x64 SSD1306 OLED (I2C) that only sends what changed: drawing goes into a frame buffer, a shadow buffer
+ * holds what the panel shows, and update() sends the changed column range of each changed page (8 rows)
+ * within a byte budget per call so large changes are spread across loop() iterations
+ * the bus traffic is compared to the full refresh path (the whole 1 KB frame every time, see getMetrics())
+ */
+class LoggerDisplay : public Adafruit_GFX, public LoggerModule {
+
+    public:
+
+        // panel geometry
+        static const int16_t width_px = 128;
+        static const int16_t height_px = 64;
+        static const size_t pages = height_px / 8; // rows of 8 pixels (one byte per column)
+        static const size_t frame_size = width_px * pages;
+
+    private:
+
+        LoggerI2CDevice device;
+        const int16_t reset_pin; // -1 if not connected
+        const size_t byte_budget; // bytes sent per loop()
+
+        // frame (drawn) and shadow (on the panel) buffers, byte = 8 rows of one column of a page
+        uint8_t frame[frame_size];
+        uint8_t shadow[frame_size];
+        uint8_t unknown_pages = 0xFF; // bitmask of the pages whose panel content is unknown (shadow not valid) until they are sent whole
+
+        // changed column range per page (dirty_min > dirty_max if the page is clean)
+        int16_t dirty_min[pages];
+        int16_t dirty_max[pages];
+        void markDirty(size_t page, int16_t from, int16_t to);
+        void markClean();
+
+        // the panel content is unknown (failed transaction): every page is resent whole by the next updates
+        void markUnknown();
+
+        // metrics
+        bool frame_pending = false; // changes of the current frame are being sent
+        uint32_t frame_bytes = 0; // bytes sent for the current frame
+        uint32_t frame_us = 0; // bus time of the current frame
+        uint32_t frames = 0; // frames sent
+        uint32_t bytes = 0; // bytes sent for frames
+        uint32_t bytes_full = 0; // bytes the full refresh path would have sent for the same frames (computed, not sent)
+        uint32_t total_us = 0; // bus time of the frames
+        uint32_t full_us = 0; // bus time of the last full refresh (a single measurement)
+
+        // send the commands (one transaction)
+        bool command(const uint8_t* commands, size_t length);
+
+        // send columns [from, to] of pages [first, last] (horizontal addressing wraps from one page to the next)
+        // returns the number of bytes sent (including control and addressing bytes), 0 if a transaction failed
+        size_t sendRegion(size_t first, size_t last, int16_t from, int16_t to);
+
+    public:
+
+        // bytes sent for a region of n data bytes: addressing command + data transactions (one control byte each)
+        static size_t regionBytes(size_t n) { return(7 + n + (n + I2C_BUFFER_LENGTH - 2) / (I2C_BUFFER_LENGTH - 1)); };
+
+        LoggerDisplay(int16_t reset_pin = -1, uint8_t address = 0x3C, size_t byte_budget = 256) :
+            Adafruit_GFX(width_px, height_px), LoggerModule("display"), device(address, "oled"), reset_pin(reset_pin), byte_budget(byte_budget) {
+            memset(frame, 0, sizeof(frame));
+            markClean();
+            markUnknown(); // until begin() or the first updates sent every page
+        };
+
+        // reset and initialize the panel, then send the (empty) frame with a full refresh
+        bool begin();
+
+        // drawing (Adafruit_GFX)
+        void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+        void fillScreen(uint16_t color) override;
+        void clearDisplay() { fillScreen(BLACK); };
+
+        // whether there are changes the panel does not show yet
+        bool isDirty();
+
+        // send changed regions (at most budget bytes), returns the number of bytes sent, stops at a failed transaction
+        // (the following updates then resend every page within the budget, skipped once LoggerI2C::loop() found the
+        // panel no longer responds)
+        size_t update(size_t budget);
+
+        // send all changes now (at most one more pass to resend the pages after a failed transaction)
+        void display();
+
+        // send the whole frame (the full refresh path, also measures its bus time for the comparison), returns false if it failed
+        bool fullRefresh();
+
+        // must be called from the global loop to send the changes within the byte budget
+        void loop() { update(byte_budget); };
+
+        /**
+         * @brief bus traffic of the partial updates compared to the full refresh path, e.g.
+         * {"frames": 12, "B": 410, "B_full_est": 12780, "B_saved_est": 12370, "us": 1020, "us_full_est": 2630}
+         * with us the average bus time per frame, the full refresh path is estimated: B_full_est is what it would
+         * have sent for the same frames (computed, not sent) and us_full_est the bus time of the last fullRefresh()
+         * (a single measurement, not an average)
+         */
+        Variant getMetrics();
+};
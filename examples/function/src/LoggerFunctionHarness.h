@@ -0,0 +1,233 @@
+#pragma once
+#include "Particle.h"
+#include "LoggerFunction.h"
+
+/**
+ * @brief checking, fuzzing and benchmarking of LoggerFunction::receiveCall (on the device via the 'check', 'fuzz' and
+ * 'bench' commands of the function example, or on the host with: rake host:function)
+ * - check: runs each corpus call once and compares its return code with the exact code expected for it
+ * - fuzz: mutates calls from a corpus (dropped/duplicated/swapped/inserted tokens, merged tokens, flipped bytes, truncation)
+ *   and checks that every call returns one of the return codes of LoggerFunction (CALL_RETURNS, plus any added with
+ *   expectCodes()) and that the free heap does not drift
+ * - benchmark: replays the corpus and reports calls/sec, us/call (in the cloud handler and in loop() separately) and
+ *   heap retained per call, calls that were rejected by a rate limit or coalesced are reported separately (they never
+ *   reach the callback), with countAllocations() also heap allocations and record copies per call
+ * LoggerFunction::loop() is called after each call so deferred execution does not fill up the command queue, the code
+ * of a deferred call is taken from its audit record (setLogger(&harness, &LoggerFunctionHarness::record))
+ * note: trace logging of the LoggerFunction dominates the timing, use LOG_LEVEL_INFO for "app" when benchmarking
+ */
+class LoggerFunctionHarness {
+
+    public:
+
+        // a corpus call and the return code it is expected to end with (after execution if it is deferred)
+        struct Call {
+            String call;
+            int code;
+        };
+
+    protected:
+
+        LoggerFunction* m_func;
+        const Vector<Call>& m_corpus; // realistic calls
+        const Vector<String> m_tokens; // dictionary of tokens used for mutations
+        Vector<int> m_codes; // return codes a fuzzed call may end with
+
+        // return code of the last audit record
+        bool m_recorded = false;
+        int m_recorded_code = 0;
+
+        // allocation and record copy counters (optional, see countAllocations())
+        std::function<uint32_t()> m_allocations;
+        std::function<uint32_t()> m_copies;
+
+        // return code the call ends with: the immediate one or, if it was queued, the one from its audit record
+        int execute(const String& call) {
+            m_recorded = false;
+            int code = m_func->receiveCall(call);
+            m_func->loop();
+            if (code == LoggerFunctionReturns::CALL_QUEUED.code && m_recorded) code = m_recorded_code;
+            return(code);
+        }
+
+        // split a call into its space separated tokens
+        Vector<String> split(const String& call) {
+            Vector<String> parts;
+            auto copy = std::make_unique<char[]>(call.length() + 1);
+            std::strcpy(copy.get(), call.c_str());
+            for (char* part = strtok(copy.get(), " "); part != nullptr; part = strtok(nullptr, " "))
+                parts.append(part);
+            return(parts);
+        }
+
+        // join tokens back into a call
+        String join(const Vector<String>& parts) {
+            String call;
+            for (size_t i = 0; i < parts.size(); ++i) {
+                if (i > 0) call += " ";
+                call += parts[i];
+            }
+            return(call);
+        }
+
+        // one random mutation of a call
+        String mutate(const String& call) {
+            Vector<String> parts = split(call);
+            size_t n = parts.size();
+            switch (random(8)) {
+                case 0: // drop a token
+                    if (n > 0) parts.removeAt(random(n));
+                    break;
+                case 1: // duplicate a token
+                    if (n > 0) { size_t i = random(n); parts.insert(i, parts[i]); }
+                    break;
+                case 2: // swap two tokens
+                    if (n > 1) { size_t i = random(n), j = random(n); String tmp = parts[i]; parts[i] = parts[j]; parts[j] = tmp; }
+                    break;
+                case 3: // insert a dictionary token
+                    parts.insert(n > 0 ? random(n + 1) : 0, m_tokens[random(m_tokens.size())]);
+                    break;
+                case 4: // replace a token with a dictionary token
+                    if (n > 0) parts[random(n)] = m_tokens[random(m_tokens.size())];
+                    break;
+                case 5: // merge two tokens (e.g. number and unit)
+                    if (n > 1) { size_t i = random(n - 1); parts[i] += parts[i + 1]; parts.removeAt(i + 1); }
+                    break;
+                case 6: { // flip a byte
+                    String mutated = join(parts);
+                    if (mutated.length() > 0) mutated.setCharAt(random(mutated.length()), (char) random(1, 256));
+                    return(mutated);
+                }
+                case 7: { // truncate
+                    String mutated = join(parts);
+                    return(mutated.length() > 0 ? mutated.substring(0, random(mutated.length())) : mutated);
+                }
+            }
+            return(join(parts));
+        }
+
+        // is this one of the expected return codes?
+        bool isExpected(int code) {
+            for (size_t i = 0; i < m_codes.size(); ++i)
+                if (m_codes[i] == code) return(true);
+            return(false);
+        }
+
+    public:
+
+        LoggerFunctionHarness(LoggerFunction* func, const Vector<Call>& corpus, const Vector<String>& tokens) : 
+            m_func(func), m_corpus(corpus), m_tokens(tokens) {
+            expectCodes(LoggerFunctionReturns::CALL_RETURNS);
+        }
+
+        /**
+         * @brief add return codes a fuzzed call may end with (e.g. the codes set by the command callbacks)
+         */
+        template <size_t N>
+        void expectCodes(const LoggerFunctionReturns::Return (&returns)[N]) {
+            for (size_t i = 0; i < N; ++i) m_codes.append(returns[i].code);
+        }
+
+        /**
+         * @brief counters the benchmark reports per call: heap allocations and (optionally) copies of call records
+         * (the device has no allocation hook, the host build counts operator new calls and Variant map copies)
+         */
+        void countAllocations(std::function<uint32_t()> allocations, std::function<uint32_t()> copies = nullptr) {
+            m_allocations = allocations;
+            m_copies = copies;
+        }
+
+        /**
+         * @brief audit record receiver for LoggerFunction::setLogger() (keeps the return code of the call)
+         */
+        bool record(Variant&& call) {
+            m_recorded = true;
+            m_recorded_code = LoggerFunctionReturns::getReturnValue(call);
+            Log.trace("record: %s", call.toJSON().c_str());
+            return(true);
+        }
+
+        /**
+         * @brief run each corpus call once and compare with its expected code, returns the number of failures
+         * calls that are rate limited or coalesced expect a fresh state (no calls within the last rate limit/coalescing window)
+         */
+        size_t check() {
+            Log.info("CHECK: %d calls", m_corpus.size());
+            size_t failures = 0;
+            for (size_t i = 0; i < m_corpus.size(); ++i) {
+                int code = execute(m_corpus[i].call);
+                if (code != m_corpus[i].code) {
+                    Log.error("CHECK: call #%d '%s' returned %d instead of %d", i, m_corpus[i].call.c_str(), code, m_corpus[i].code);
+                    failures++;
+                }
+            }
+            Log.info("CHECK: %d calls, %d failures", m_corpus.size(), failures);
+            return(failures);
+        }
+
+        /**
+         * @brief run n mutated calls (reproducible for the same seed), returns the number of failures
+         */
+        size_t fuzz(size_t n, uint32_t seed) {
+            Log.info("FUZZ: %d mutated calls (seed %lu)", n, (unsigned long) seed);
+            randomSeed(seed);
+            size_t failures = 0;
+            uint32_t mem_before = System.freeMemory();
+            for (size_t i = 0; i < n; ++i) {
+                // mutate a corpus call 1-3 times
+                String call = m_corpus[random(m_corpus.size())].call;
+                for (long j = random(1, 4); j > 0; --j) call = mutate(call);
+                int code = execute(call);
+                if (!isExpected(code)) {
+                    Log.error("FUZZ: call #%d '%s' returned unexpected code %d", i, call.c_str(), code);
+                    failures++;
+                }
+            }
+            int32_t mem_drift = (int32_t) mem_before - (int32_t) System.freeMemory();
+            Log.info("FUZZ: %d calls, %d failures, free heap drift: %ld B", n, failures, (long) mem_drift);
+            return(failures);
+        }
+
+        /**
+         * @brief replay the corpus for n calls and report throughput and heap retained per call
+         * (separately for calls that were rejected by a rate limit or coalesced), the time in the cloud handler
+         * (receiveCall) is what the caller waits for, the time in loop() is where deferred calls execute
+         */
+        void benchmark(size_t n) {
+            Log.info("BENCH: %d calls from a corpus of %d", n, m_corpus.size());
+            // paths: 0 = parsed (and executed if valid), 1 = rate limited, 2 = coalesced
+            const char* paths[] = {"parsed", "rate limited", "coalesced"};
+            size_t calls[3] = {0, 0, 0};
+            unsigned long handler_us[3] = {0, 0, 0}, loop_us[3] = {0, 0, 0}, max_us[3] = {0, 0, 0};
+            uint32_t allocations[3] = {0, 0, 0}, copies[3] = {0, 0, 0};
+            uint32_t mem_before = System.freeMemory();
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t allocations_before = m_allocations ? m_allocations() : 0;
+                uint32_t copies_before = m_copies ? m_copies() : 0;
+                unsigned long start = micros();
+                int code = m_func->receiveCall(m_corpus[i % m_corpus.size()].call);
+                unsigned long handled = micros();
+                m_func->loop();
+                unsigned long end = micros();
+                size_t path = code == LoggerFunctionReturns::CALL_ERR_RATE_LIMIT.code ? 1 : code == LoggerFunctionReturns::CALL_COALESCED.code ? 2 : 0;
+                calls[path]++;
+                handler_us[path] += handled - start;
+                loop_us[path] += end - handled;
+                if (end - start > max_us[path]) max_us[path] = end - start;
+                if (m_allocations) allocations[path] += m_allocations() - allocations_before;
+                if (m_copies) copies[path] += m_copies() - copies_before;
+            }
+            int32_t mem_retained = (int32_t) mem_before - (int32_t) System.freeMemory();
+            for (size_t path = 0; path < 3; ++path) {
+                if (calls[path] == 0) continue;
+                unsigned long total_us = handler_us[path] + loop_us[path];
+                Log.info("BENCH %s: %d calls, %.1f calls/sec, %.1f us/call (handler %.1f us, loop %.1f us, max %lu us)", paths[path], calls[path],
+                    total_us > 0 ? 1e6 * calls[path] / total_us : 0.0, (double) total_us / calls[path],
+                    (double) handler_us[path] / calls[path], (double) loop_us[path] / calls[path], max_us[path]);
+                if (m_allocations) Log.info("BENCH %s: %.1f allocations/call", paths[path], (double) allocations[path] / calls[path]);
+                if (m_copies) Log.info("BENCH %s: %.2f record copies/call", paths[path], (double) copies[path] / calls[path]);
+            }
+            Log.info("BENCH: %.1f B heap retained per call", (double) mem_retained / n);
+        }
+
+};
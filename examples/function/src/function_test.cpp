@@ -4,6 +4,9 @@
  *  - flash to device of joice
  *  - either call any commands directly with particle call DEVICE test "test4"
  *  - or start the set of auto-tests by calling particle call DEVICE test "auto_test"
+ *  - check the return code of each test call with particle call DEVICE test "check" (with the auto-tests off)
+ *  - fuzz the parser with particle call DEVICE test "fuzz 1000" (number of mutated calls)
+ *  - benchmark the parser with particle call DEVICE test "bench 500" (number of calls)
  */
 
 #include "Particle.h"
@@ -11,6 +14,7 @@
 #include "LoggerFunctionReturns.h"
 #include "LoggerModule.h"
 #include "LoggerTimer.h"
+#include "LoggerFunctionHarness.h"
 
 // enable system treading
 #ifndef SYSTEM_VERSION_v620
@@ -26,6 +30,8 @@ SerialLogHandler logHandler(LOG_LEVEL_INFO, { // Logging level for non-applicati
 namespace LoggerFunctionReturns {
     inline constexpr Error MY_WARNING  = {100, "my favorite warning"};
     inline constexpr Error MY_ERROR  = {-100, "my favorite error"};
+    inline constexpr Return MY_RETURNS[] = {MY_WARNING, MY_ERROR};
+    static_assert(hasUniqueCodes(MY_RETURNS, CALL_RETURNS), "return codes collide with LoggerFunction return codes");
 }
 
 // custom component class examples
@@ -34,6 +40,9 @@ class MyModule : public LoggerModule {
     public:
 
         bool auto_test_running = false;
+        bool check_calls = false;
+        size_t fuzz_calls = 0;
+        size_t bench_calls = 0;
 
         MyModule(const char* name) : LoggerModule(name) {}
 
@@ -44,6 +53,24 @@ class MyModule : public LoggerModule {
             return(true);
         }
 
+        // 'check' (runs from loop)
+        bool check(Variant& call) {
+            check_calls = true;
+            return(true);
+        }
+
+        // 'fuzz' (runs from loop so the fuzzer does not call itself recursively)
+        bool fuzz(Variant& call) {
+            fuzz_calls = call.has("vnum") ? call.get("vnum").toInt() : 1000;
+            return(true);
+        }
+
+        // 'bench' (runs from loop)
+        bool bench(Variant& call) {
+            bench_calls = call.has("vnum") ? call.get("vnum").toInt() : 500;
+            return(true);
+        }
+
         // 'hello'
         void registerHelloCommand(LoggerFunction* func, const char* cmd = "hello") {
             func->registerCommand(this, &MyModule::hello, cmd);   
@@ -88,13 +115,50 @@ MyModule* mod = new MyModule("mod1");
 String available_cmds;
 String last_cmd;
 
+// testing commands (and the code each one ends with)
+using namespace LoggerFunctionReturns;
+const Vector<LoggerFunctionHarness::Call> calls {
+    {"non-existent-cmd", CALL_ERR_CMD_MOD_UNREC.code},
+    {"whatup", MY_ERROR.code}, {"WHATUP", MY_ERROR.code},
+    {"mod-dne hello", CALL_ERR_CMD_MOD_UNREC.code}, {"mod1 hello note=whatever is up with=that user=test user", MY_WARNING.code},
+    {"test1", CMD_SUCCESS},
+    {"test2", CALL_ERR_VAL_MISS.code}, {"test2 on", CMD_SUCCESS}, {"test2 blib", CALL_ERR_VAL_UNREC.code}, {"test2 off extra user=test", CMD_SUCCESS},
+    {"test3", CMD_SUCCESS}, {"test3 2", CMD_SUCCESS}, {"test3 2 kg", CMD_SUCCESS}, {"test3 b note=hello #3", CMD_SUCCESS},
+    {"test4", CALL_ERR_VAL_MISS.code}, {"test4 x", CALL_ERR_VAL_NAN.code}, {"test4 1kg", CALL_ERR_UNIT_UNEXP.code}, {"test4 -2.352", CMD_SUCCESS},
+    {"test5", CMD_SUCCESS}, {"test5 y", CALL_ERR_VAL_NAN.code}, {"test5 4.2", CALL_ERR_UNIT_MISS.code}, {"test5 -42what", CALL_ERR_UNIT_UNREC.code}, 
+    {"test5 1.3e3 myunit", CALL_ERR_UNIT_UNREC.code}, {"test5 -1sec user=test", CMD_SUCCESS}, {"test5 24.1 min note=hello", CMD_SUCCESS},
+    {"test6", CALL_ERR_VAL_MISS.code}, {"test6 manual", CMD_SUCCESS}, {"test6 dne", CALL_ERR_VAL_NAN.code}, {"test6 42", CALL_ERR_UNIT_MISS.code}, {"test6 -4.2ms", CMD_SUCCESS},
+    {"test7 1.5min", CMD_SUCCESS}, {"test7 250 ms", CMD_SUCCESS}, {"test7 2 days", CALL_ERR_UNIT_UNREC.code},
+    {"commands 99", CALL_ERR_PAGE_UNREC.code},
+    // rate limit (burst of 2) and coalescing (same value as the last test2 call)
+    {"test1", CMD_SUCCESS}, {"test1", CALL_ERR_RATE_LIMIT.code}, {"test2 off", CALL_COALESCED.code}
+};
+
+// dictionary of tokens for fuzzing
+const Vector<String> tokens {
+    "mod1", "hello", "whatup", "test1", "test2", "test3", "test4", "test5", "test6", "test7", "commands",
+    "on", "off", "a", "b", "2", "manual", "ms", "sec", "min", "hr", "kg",
+    "user=", "note=", "user=x", "=", "-", ".", "1e999", "-0", "nan", "4.2", "1.5min", "0x10", "  "
+};
+
+// fuzzed calls can end with any of the LoggerFunction return codes plus the ones of the callbacks
+LoggerFunctionHarness harness(func, calls, tokens);
+
 // setup
 void setup() {
 
+    // heap taken up by the commands (measured across all registrations and the catalog built in func->setup())
+    uint32_t mem_before = System.freeMemory();
+
     // register a suite of test commands
     // start auto-test
     func->registerCommand(mod, &MyModule::auto_test, "auto-test");
 
+    // checking, fuzzing and benchmarking of the parser
+    func->registerCommand(mod, &MyModule::check, "check");
+    func->registerCommandWithNumericValues(mod, &MyModule::fuzz, "fuzz", {}, true);
+    func->registerCommandWithNumericValues(mod, &MyModule::bench, "bench", {}, true);
+
     // register all commands defined in the module class (usually all of them defined there)
     mod->registerHelloCommand(func);
     mod->registerWhatupCommand(func);
@@ -118,22 +182,40 @@ void setup() {
     // command that accepts mixed values with a few specific text values OR numeric values with specific units
     func->registerCommandWithMixedValues(mod, &MyModule::test, "test6", {"manual"}, {"ms", "sec"});
 
+    // command that accepts numeric values in time units, callback receives the value in seconds ("vnorm") and the unit index ("uid")
+    func->registerCommandWithNumericValues(mod, &MyModule::test, "test7", LoggerFunctionUnits::time);
+
+    // rate limit test1 (at most 2 calls at once, then 1 call every 5 seconds) 
+    func->setRateLimit("test1", 0.2, 2);
+
+    // don't execute test2 again if it is called with the same value within 10 seconds
+    func->setCoalescing("test2", 10000);
+
+    // execute callbacks from loop() instead of the cloud handler
+    // (comment out to compare call latency with immediate execution)
+    uint32_t mem_queue = System.freeMemory();
+    func->deferExecution();
+    mem_queue -= System.freeMemory();
+
+    // per-command profile in the 'cmd_profile' variable (including heap retained by callbacks)
+    func->enableProfiling("cmd_profile", true);
+
+    // register the custom return codes (so they are part of the commands catalog)
+    LoggerFunctionReturns::registerReturnCodes(LoggerFunctionReturns::MY_RETURNS);
+
+    // audit records go to the test harness (return codes of deferred calls)
+    harness.expectCodes(LoggerFunctionReturns::MY_RETURNS);
+    func->setLogger(&harness, &LoggerFunctionHarness::record);
+
     // start listening to function calls
     func->setup();
-}
 
-// testing commands
-const Vector<String> calls {
-    "non-existent-cmd",
-    "whatup", "WHATUP",
-    "mod-dne hello", "mod1 hello note=whatever is up with=that user=test user",
-    "test1",
-    "test2", "test2 on", "test2 blib", "test2 off extra user=test",
-    "test3", "test3 2", "test3 2 kg", "test3 b note=hello #3",
-    "test4", "test4 x", "test4 1kg", "test4 -2.352",
-    "test5", "test5 y", "test5 4.2", "test5 -42what", "test5 1.3e3 myunit", "test5 -1sec user=test", "test5 24.1 min note=hello",
-    "test6", "test6 manual", "test6 dne", "test6 42", "test6 -4.2ms"
-};
+    // RAM per command (without the deferred call queue, which does not depend on the number of commands)
+    uint32_t mem_used = mem_before - System.freeMemory() - mem_queue;
+    Log.info("COMMANDS: %d commands take up %lu B of heap (%.1f B/command), %d B of it interned names, plus %lu B call queue",
+        func->getCommandsCount(), (unsigned long) mem_used, (double) mem_used / func->getCommandsCount(),
+        LoggerFunctionStrings::getBytes(), (unsigned long) mem_queue);
+}
 
 unsigned long last_call = 0;
 size_t call_i = 0;
@@ -147,14 +229,34 @@ void loop() {
         if (call_i >= calls.size()) call_i = 0;
         Log.print("\n");
         uint32_t mem_before = System.freeMemory();
-        Log.info("CALL #%d (free mem: %.3f KB): '%s'", call_i, (float) System.freeMemory() / 1024., calls[call_i].c_str());
-        func->receiveCall(String(calls[call_i]));
+        Log.info("CALL #%d (free mem: %.3f KB): '%s'", call_i, (float) System.freeMemory() / 1024., calls[call_i].call.c_str());
+        unsigned long call_start = micros();
+        func->receiveCall(calls[call_i].call);
+        unsigned long call_time = micros() - call_start;
         uint32_t mem_after = System.freeMemory();
+        Log.info("CALL latency: %lu us", call_time);
         Log.info("FREE MEM loss: %d B", mem_before - mem_after);
         Log.print("\n");
         call_i++;
         last_call = millis();
     }
 
+    // execute queued commands
+    func->loop();
+
+    // checking, fuzzing and benchmarking
+    if (mod->check_calls) {
+        harness.check();
+        mod->check_calls = false;
+    }
+    if (mod->fuzz_calls > 0) {
+        harness.fuzz(mod->fuzz_calls, millis());
+        mod->fuzz_calls = 0;
+    }
+    if (mod->bench_calls > 0) {
+        harness.benchmark(mod->bench_calls);
+        mod->bench_calls = 0;
+    }
+
 }
 
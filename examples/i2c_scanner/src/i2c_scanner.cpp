@@ -1,5 +1,5 @@
 #include "Particle.h"
-#include "Wire.h"
+#include "LoggerI2C.h"
 
 // enable system treading
 #ifndef SYSTEM_VERSION_v620
@@ -14,38 +14,40 @@ SerialLogHandler logHandler(LOG_LEVEL_TRACE);
 
 // setup
 void setup() {
-  Wire.begin();
+  // first scan (LoggerI2C starts the bus and caches the map of the addresses that respond)
+  LoggerI2C::discover();
 }
- 
+
 // loop
 uint counter = 0;
 unsigned long timer = 0;
 const std::chrono::milliseconds wait = 2s;
-const std::chrono::milliseconds timeout = 100ms;
 
 void loop() {
-  byte error, address;
-  int n_devices = 0;
- 
+
   if (millis() - timer > wait.count()) {
-    
+    timer = millis();
     Log.info("I2C scan #%d...", ++counter);
-  
-    for(address = 1; address < 127; address++ ) {
-      timer = millis();
-      Wire.beginTransmission(address);
-      error = Wire.endTransmission();
-      if (error == 0) {
-        Log.info("I2C device #%d at address 0x%02X", ++n_devices, address);
-      } else if (error==4) {
-        Log.error("Unknown error at address 0x%02X", address);
-      } else if (millis() - timer > timeout.count()) {
-        Log.error("Timeout at address 0x%02X, there might be an I2C issue.", address);
-      }    
+
+    // every address is probed with a short timeout (LoggerI2C::probe_timeout) and the bus lock is only held per address
+    uint32_t previous[4];
+    for (size_t i = 0; i < 4; i++) previous[i] = LoggerI2C::device_map[i];
+    LoggerI2C::discover(true);
+
+    int n_devices = 0;
+    for (uint8_t address = 1; address < 127; address++) {
+      uint32_t bit = 1UL << (address % 32);
+      bool found = LoggerI2C::isPresent(address);
+      bool was = previous[address / 32] & bit;
+      if (found) {
+        Log.info("I2C device #%d at address 0x%02X%s", ++n_devices, address, was ? "" : " (new)");
+      } else if (was) {
+        Log.warn("I2C device at address 0x%02X stopped responding", address);
+      }
     }
     if (n_devices == 0)
       Log.info("No I2C devices found.\n");
     else
-      Log.info("Done.\n");
+      Log.info("Done in %lu ms.\n", millis() - timer);
   }
-}
\ No newline at end of file
+}
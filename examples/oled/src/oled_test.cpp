@@ -1,7 +1,12 @@
+/**
+ * test for the LoggerDisplay class (partial OLED updates)
+ * to use:
+ *  - flash to a device with a 128x64 SSD1306 OLED on I2C address 0x3C
+ *  - watch the serial log for the bus traffic compared to full refreshes
+ */
+
 #include "Particle.h"
-#include "Wire.h"
-#include "Adafruit_GFX.h"
-#include "Adafruit_SSD1306.h"
+#include "LoggerDisplay.h"
 
 // enable system treading
 #ifndef SYSTEM_VERSION_v620
@@ -13,11 +18,11 @@ SerialLogHandler logHandler(LOG_LEVEL_INFO);
 
 // Use I2C with OLED RESET pin
 #define OLED_RESET D10 // D10 on photon2, D8 on argon/boron
-Adafruit_SSD1306 display(OLED_RESET);
+LoggerDisplay display(OLED_RESET);
 
 void setup() {
-    display.begin(SSD1306_SWITCHCAPVCC, 0x3C);  // initialize with the I2C addr 0x3C (for the 128x64)
-    display.display(); // show splashscreen
+    LoggerI2C::discover(); // scan the bus once (isPresent() only reads the cached map)
+    display.begin(); // initialize with the I2C addr 0x3C (for the 128x64)
     display.setTextSize(1);
     display.setTextColor(WHITE);
 }
@@ -34,8 +39,14 @@ void loop() {
         display.setCursor(0, 0);
         display.clearDisplay();
         display.printf("hello %d...", counter);
-        display.display();
+        Log.info("display: %s", display.getMetrics().toJSON().c_str());
 
         counter++;
     }
+
+    // send the changes (within the byte budget)
+    display.loop();
+
+    // rescan the display if it stopped responding (updates are skipped while it is gone)
+    LoggerI2C::loop();
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "LoggerUtils.h"
 #include "LoggerPlatform.h"
 #include "LoggerPublisher.h"
+#include "LoggerSDEmulator.h"
 
 // Let Device OS manage the connection to the Particle Cloud
 SYSTEM_MODE(AUTOMATIC);
@@ -39,6 +40,13 @@ void outOfMemoryHandler(system_event_t event, int param) {
     outOfMemory = param;
 }
 
+// low memory callback (triggered from LoggerPlatform::loop() before memory runs out)
+bool lowMemory = false;
+
+void lowMemoryHandler(const LoggerPlatform::HeapSample& sample, float seconds) {
+    lowMemory = true;
+}
+
 bool nameRequested = false;
 
 // // Open a serial terminal and see the IP address printed out
@@ -49,10 +57,17 @@ bool nameRequested = false;
 
 LoggerPublisher *publisher = new LoggerPublisher();
 
+// emulate the SD card reader on the flash file system (for testing without a Qwiic OpenLog)
+const bool emulateSD = false;
+LoggerSDEmulator sdEmulator("/sdemu");
+
 void setup() {
     // Enabling an out of memory handler is a good safety tip. If we run out of
     // memory a System.reset() is done.
     System.on(out_of_memory, outOfMemoryHandler);
+    // and a low memory callback that fires when the largest free block drops below 10kB
+    // or runs out within the next 60 s at the current rate
+    LoggerPlatform::onLowMemory(lowMemoryHandler, 10 * LoggerPlatform::KB, 60);
 
     // For testing purposes, wait 10 seconds before continuing to allow serial to connect
 	// before doing PublishQueue setup so the debug log messages can be read.
@@ -70,9 +85,16 @@ void setup() {
     DeviceNameHelperEEPROM::instance().setup(0);
     DeviceNameHelperEEPROM::instance().checkName();
 
+    // scan the I2C bus once (the device map is cached and reported in the system status)
+    LoggerI2C::discover();
+
     // from: https://build.particle.io/libs/PublishQueueExtRK/0.0.6/tab/example/2-test-suite.cpp
+    if (emulateSD) publisher->setSdPort(&sdEmulator);
     publisher->setup();
 
+    // SD card write speeds (byte-wise vs. bulk transfers, 100 vs. 400 kHz)
+    publisher->benchmarkSD();
+
     // TODO:
     // - implmement a LoggerPlatform static class that holds the info about flash size, memory size, wifi/cellular bools, etc. and is set basaed on platform_ID
     // - implmenet the Event publish as an extension of the PublishQueueExtRK class (check this function https://github.com/rickkas7/PublishQueueExtRK/blob/c6f147c5099abdf6120360acfa4833a04ea9136e/src/PublishQueueExtRK.cpp#L431)
@@ -92,6 +114,12 @@ void loop() {
     // keep device name updated
     DeviceNameHelperEEPROM::instance().loop();
 
+    // low memory: shed load by pausing the test data (below) until memory recovers
+    if (lowMemory) {
+        lowMemory = false;
+        Log.warn("low memory - pausing data until memory recovers");
+    }
+
     // out of memory handler //
     if (outOfMemory >= 0) {
         // An out of memory condition occurred - reset device.
@@ -102,9 +130,10 @@ void loop() {
     // out of memory handler //
 
 
-    if (millis() - lastRun > publishPeriod.count()) {
+    if (millis() - lastRun > publishPeriod.count() && !LoggerPlatform::heap_low) {
 
         lastRun = millis();
+        LoggerPlatform::ProfileSection section("stats"); // shows up as "stall" in the loop profile if it's the slowest
         runPlatformStats();
 
         Variant obj;
@@ -114,10 +143,14 @@ void loop() {
     }
 
     publisher->loop();
+    LoggerPlatform::loop();
 
     // approach
 }
 
+// status reports with changes only (keyframe every 12 reports = 1 min)
+LoggerPlatform::StatusReporter statusReporter;
+
 void runPlatformStats() {
 
     using namespace LoggerPlatform;
@@ -134,10 +167,20 @@ void runPlatformStats() {
     // event.data(var);
     // Particle.publish(event);
 
-    Variant sys = getSystemStatus();
-    sys.remove("id"); // don't need to display this
-    sys.set("% RAM", checkNaN(getFreeRAMPercent())); // add this
-    sys.set("% flash", checkNaN(getFreeFlashPercent())); // add this
-    Log.info("system status");
-    Log.print(sys.toJSON().c_str()); Log.print("\n"); // full dump
+    unsigned long start = micros();
+    Variant sys = statusReporter.report();
+    unsigned long status_us = micros() - start;
+    if (sys.has("kf")) {
+        // full keyframe
+        sys.remove("id"); // don't need to display this
+        sys.set("% RAM", checkNaN(getFreeRAMPercent())); // add this
+        sys.set("% flash", checkNaN(getFreeFlashPercent())); // add this
+    }
+    Log.info("system status (took %lu us)", status_us);
+    Log.print(sys.toJSON().c_str()); Log.print("\n"); // full dump or changes only
+    if (sys.has("kf")) {
+        // storage tiers with every keyframe
+        Log.info("storage tiers");
+        Log.print(publisher->getStorageMetrics().toJSON().c_str()); Log.print("\n");
+    }
 }
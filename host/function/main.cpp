@@ -0,0 +1,43 @@
+/**
+ * host run of the function example (examples/function): checks and fuzzes the parser, then benchmarks it with
+ * deferred and with immediate execution, reporting heap allocations and call record copies per call
+ * usage: rake host:function [CALLS=2000] [SEED=1] [LOG=trace]
+ * exits with 1 if any check or fuzzed call fails
+ */
+
+#include "Particle.h"
+#include "LoggerFunction.h"
+#include "LoggerFunctionHarness.h"
+
+// from examples/function/src/function_test.cpp
+extern LoggerFunction* func;
+extern LoggerFunctionHarness harness;
+void setup();
+
+int main() {
+
+    // parameters
+    size_t n = getenv("CALLS") ? strtoul(getenv("CALLS"), nullptr, 10) : 2000;
+    uint32_t seed = getenv("SEED") ? strtoul(getenv("SEED"), nullptr, 10) : 1;
+    bool trace = getenv("LOG") && strcmp(getenv("LOG"), "trace") == 0;
+
+    // setup of the example (its log handler traces, which would dominate the timing)
+    setup();
+    host::setLogLevel(trace ? LOG_LEVEL_TRACE : LOG_LEVEL_INFO);
+    Particle.connect();
+    harness.countAllocations(host::getAllocations, host::getMapCopies);
+
+    // correctness
+    size_t failures = harness.check();
+    failures += harness.fuzz(n, seed);
+
+    // latency: deferred (the example's setting) vs immediate execution
+    Log.info("BENCH: deferred execution");
+    harness.benchmark(n);
+    func->deferExecution(0);
+    Log.info("BENCH: immediate execution");
+    harness.benchmark(n);
+
+    Log.info("HOST: %d failures", failures);
+    return(failures > 0 ? 1 : 0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+/**
+ * @brief host stand-in for the FileHelperRK library (only the flash usage LoggerPlatform measures):
+ * the host has no flash file system, a measurement finds nothing so the usage LoggerPlatform tracks starts at 0
+ */
+namespace FileHelperRK {
+
+    struct Usage {
+        size_t sectors = 0;
+        size_t files = 0;
+        size_t dirs = 0;
+        int measure(const char* path, bool recursive = true) { return(0); }
+    };
+}
@@ -0,0 +1,636 @@
+#include "Particle.h"
+#include <new>
+#include <cstddef>
+#include <random>
+#include <thread>
+
+/*** heap accounting ***/
+
+static std::atomic<uint32_t> s_allocations{0};
+static std::atomic<size_t> s_allocated{0};
+
+// every block carries its size in front of it so delete can account for it
+static const size_t header = alignof(std::max_align_t);
+
+static void* allocate(size_t size) {
+    void* block = malloc(size + header);
+    if (block == nullptr) throw std::bad_alloc();
+    *(size_t*) block = size;
+    s_allocations++;
+    s_allocated += size;
+    return((uint8_t*) block + header);
+}
+
+static void deallocate(void* p) {
+    if (p == nullptr) return;
+    void* block = (uint8_t*) p - header;
+    s_allocated -= *(size_t*) block;
+    free(block);
+}
+
+void* operator new(size_t size) { return(allocate(size)); }
+void* operator new[](size_t size) { return(allocate(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { try { return(allocate(size)); } catch (...) { return(nullptr); } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return(allocate(size)); } catch (...) { return(nullptr); } }
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete[](void* p) noexcept { deallocate(p); }
+void operator delete(void* p, size_t) noexcept { deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p); }
+
+uint32_t host::getAllocations() { return(s_allocations); }
+size_t host::getAllocatedBytes() { return(s_allocated); }
+
+uint32_t SystemClass::freeMemory() {
+    size_t allocated = s_allocated;
+    return(allocated < host::heap_size ? host::heap_size - allocated : 0);
+}
+
+/*** String ***/
+
+String String::format(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    if (n <= 0) return(String());
+    std::string text(n, '\0');
+    va_start(args, fmt);
+    vsnprintf(&text[0], n + 1, fmt, args);
+    va_end(args);
+    return(String(text));
+}
+
+/*** Variant ***/
+
+static std::atomic<uint32_t> s_variant_copies{0};
+static std::atomic<uint32_t> s_map_copies{0};
+
+uint32_t host::getVariantCopies() { return(s_variant_copies); }
+uint32_t host::getMapCopies() { return(s_map_copies); }
+
+void Variant::copyFrom(const Variant& other) {
+    s_variant_copies++;
+    if (other.t == MAP) s_map_copies++;
+    t = other.t;
+    b = other.b;
+    i = other.i;
+    u = other.u;
+    d = other.d;
+    s = other.s;
+    a.reset(other.a ? new VariantArray(*other.a) : nullptr);
+    m.reset(other.m ? new VariantMap(*other.m) : nullptr);
+}
+
+Variant::Variant(const VariantArray& value) : t(ARRAY), a(new VariantArray(value)) {}
+Variant::Variant(VariantArray&& value) : t(ARRAY), a(new VariantArray(std::move(value))) {}
+Variant::Variant(const VariantMap& value) : t(MAP), m(new VariantMap(value)) {}
+Variant::Variant(const Variant& other) { copyFrom(other); }
+Variant::Variant(Variant&& other) noexcept :
+    t(other.t), b(other.b), i(other.i), u(other.u), d(other.d), s(std::move(other.s)), a(std::move(other.a)), m(std::move(other.m)) {
+    other.t = NULL_;
+}
+Variant& Variant::operator=(const Variant& other) {
+    if (this != &other) {
+        Variant copy(other);
+        *this = std::move(copy);
+    }
+    return(*this);
+}
+Variant& Variant::operator=(Variant&& other) noexcept {
+    if (this != &other) {
+        t = other.t;
+        b = other.b;
+        i = other.i;
+        u = other.u;
+        d = other.d;
+        s = std::move(other.s);
+        a = std::move(other.a);
+        m = std::move(other.m);
+        other.t = NULL_;
+    }
+    return(*this);
+}
+Variant::~Variant() {}
+
+VariantMap& Variant::map() {
+    if (t != MAP) {
+        *this = Variant();
+        t = MAP;
+        m.reset(new VariantMap());
+    }
+    return(*m);
+}
+
+VariantArray& Variant::array() {
+    if (t != ARRAY) {
+        *this = Variant();
+        t = ARRAY;
+        a.reset(new VariantArray());
+    }
+    return(*a);
+}
+
+const Variant* Variant::find(const char* key) const {
+    if (t != MAP || key == nullptr) return(nullptr);
+    for (const auto& entry : *m) {
+        if (entry.first == key) return(&entry.second);
+    }
+    return(nullptr);
+}
+
+bool Variant::toBool() const {
+    switch (t) {
+        case BOOL: return(b);
+        case INT: case INT64: return(i != 0);
+        case UINT: case UINT64: return(u != 0);
+        case DOUBLE: return(d != 0);
+        case STRING: return(s == "true" || s.toDouble() != 0);
+        default: return(false);
+    }
+}
+
+int64_t Variant::toInt64() const {
+    switch (t) {
+        case BOOL: return(b);
+        case INT: case INT64: return(i);
+        case UINT: case UINT64: return((int64_t) u);
+        case DOUBLE: return((int64_t) d);
+        case STRING: return(strtoll(s.c_str(), nullptr, 10));
+        default: return(0);
+    }
+}
+
+uint64_t Variant::toUInt64() const {
+    switch (t) {
+        case UINT: case UINT64: return(u);
+        case STRING: return(strtoull(s.c_str(), nullptr, 10));
+        default: return((uint64_t) toInt64());
+    }
+}
+
+double Variant::toDouble() const {
+    switch (t) {
+        case DOUBLE: return(d);
+        case INT: case INT64: return((double) i);
+        case UINT: case UINT64: return((double) u);
+        case BOOL: return(b ? 1 : 0);
+        case STRING: return(strtod(s.c_str(), nullptr));
+        default: return(0);
+    }
+}
+
+int& Variant::asInt() {
+    int value = toInt();
+    *this = Variant();
+    t = INT;
+    i = value;
+    // the int is kept in the 64 bit member (little endian: its first 4 bytes are the int)
+    return(*reinterpret_cast<int*>(&i));
+}
+
+static String formatDouble(double value) {
+    if (!std::isfinite(value)) return("null");
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return(buffer);
+}
+
+String Variant::toString() const {
+    switch (t) {
+        case BOOL: return(b ? "true" : "false");
+        case INT: case INT64: return(String((long long) i));
+        case UINT: case UINT64: return(String((unsigned long long) u));
+        case DOUBLE: return(formatDouble(d));
+        case STRING: return(s);
+        default: return(String());
+    }
+}
+
+int Variant::size() const {
+    switch (t) {
+        case STRING: return(s.length());
+        case ARRAY: return(a->size());
+        case MAP: return(m->size());
+        default: return(0);
+    }
+}
+
+bool Variant::isEmpty() const {
+    return(t == NULL_ || ((t == STRING || t == ARRAY || t == MAP) && size() == 0));
+}
+
+bool Variant::set(const char* key, const Variant& value) {
+    Variant copy(value);
+    return(set(key, std::move(copy)));
+}
+
+bool Variant::set(const char* key, Variant&& value) {
+    VariantMap& entries = map();
+    for (auto& entry : entries) {
+        if (entry.first == key) {
+            entry.second = std::move(value);
+            return(true);
+        }
+    }
+    entries.append(std::make_pair(String(key), std::move(value)));
+    return(true);
+}
+
+bool Variant::remove(const char* key) {
+    if (t != MAP) return(false);
+    for (int j = 0; j < m->size(); j++) {
+        if ((*m)[j].first == key) {
+            m->removeAt(j);
+            return(true);
+        }
+    }
+    return(false);
+}
+
+Variant& Variant::operator[](const char* key) {
+    VariantMap& entries = map();
+    for (auto& entry : entries) {
+        if (entry.first == key) return(entry.second);
+    }
+    entries.append(std::make_pair(String(key), Variant()));
+    return(entries.last().second);
+}
+
+bool Variant::operator==(const Variant& other) const {
+    if (isNumber() && other.isNumber()) return(toDouble() == other.toDouble());
+    if (t != other.t) return(false);
+    switch (t) {
+        case NULL_: return(true);
+        case BOOL: return(b == other.b);
+        case STRING: return(s == other.s);
+        case ARRAY:
+            if (a->size() != other.a->size()) return(false);
+            for (int j = 0; j < a->size(); j++) if ((*a)[j] != (*other.a)[j]) return(false);
+            return(true);
+        case MAP:
+            if (m->size() != other.m->size()) return(false);
+            for (const auto& entry : *m) {
+                const Variant* value = other.find(entry.first.c_str());
+                if (value == nullptr || *value != entry.second) return(false);
+            }
+            return(true);
+        default: return(false);
+    }
+}
+
+static void writeJSONString(String& out, const String& text) {
+    out += '"';
+    for (unsigned j = 0; j < text.length(); j++) {
+        char c = text[j];
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((uint8_t) c < 0x20) out += String::format("\\u%04x", (unsigned) (uint8_t) c);
+                else out += c;
+        }
+    }
+    out += '"';
+}
+
+static void writeJSON(String& out, const Variant& value) {
+    switch (value.type()) {
+        case Variant::NULL_: out += "null"; break;
+        case Variant::STRING: writeJSONString(out, value.toString()); break;
+        case Variant::ARRAY: {
+            out += '[';
+            const VariantArray& values = const_cast<Variant&>(value).asArray();
+            for (int j = 0; j < values.size(); j++) {
+                if (j > 0) out += ',';
+                writeJSON(out, values[j]);
+            }
+            out += ']';
+            break;
+        }
+        case Variant::MAP: {
+            out += '{';
+            const VariantMap& entries = const_cast<Variant&>(value).asMap();
+            for (int j = 0; j < entries.size(); j++) {
+                if (j > 0) out += ',';
+                writeJSONString(out, entries[j].first);
+                out += ':';
+                writeJSON(out, entries[j].second);
+            }
+            out += '}';
+            break;
+        }
+        default: out += value.toString();
+    }
+}
+
+String Variant::toJSON() const {
+    String out;
+    writeJSON(out, *this);
+    return(out);
+}
+
+// recursive descent JSON parser (returns a null Variant for invalid JSON)
+namespace {
+    struct JSONParser {
+        const char* p;
+        bool ok = true;
+
+        void skip() { while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++; }
+
+        String parseString() {
+            String text;
+            p++; // opening quote
+            while (*p != '\0' && *p != '"') {
+                if (*p == '\\') {
+                    p++;
+                    switch (*p) {
+                        case 'n': text += '\n'; break;
+                        case 'r': text += '\r'; break;
+                        case 't': text += '\t'; break;
+                        case 'b': text += '\b'; break;
+                        case 'f': text += '\f'; break;
+                        case 'u': {
+                            char hex[5] = {0};
+                            for (int j = 0; j < 4 && p[1] != '\0'; j++) hex[j] = *++p;
+                            unsigned code = strtoul(hex, nullptr, 16);
+                            if (code < 0x80) text += (char) code;
+                            else text += '?';
+                            break;
+                        }
+                        case '\0': ok = false; return(text);
+                        default: text += *p;
+                    }
+                    p++;
+                } else {
+                    text += *p++;
+                }
+            }
+            if (*p != '"') ok = false;
+            else p++;
+            return(text);
+        }
+
+        Variant parseValue() {
+            skip();
+            if (*p == '{') {
+                p++;
+                Variant map;
+                map.asMap();
+                skip();
+                if (*p == '}') { p++; return(map); }
+                while (ok) {
+                    skip();
+                    if (*p != '"') { ok = false; break; }
+                    String key = parseString();
+                    skip();
+                    if (*p != ':') { ok = false; break; }
+                    p++;
+                    map.set(key, parseValue());
+                    skip();
+                    if (*p == ',') { p++; continue; }
+                    if (*p == '}') { p++; break; }
+                    ok = false;
+                }
+                return(map);
+            }
+            if (*p == '[') {
+                p++;
+                Variant array;
+                array.asArray();
+                skip();
+                if (*p == ']') { p++; return(array); }
+                while (ok) {
+                    array.append(parseValue());
+                    skip();
+                    if (*p == ',') { p++; continue; }
+                    if (*p == ']') { p++; break; }
+                    ok = false;
+                }
+                return(array);
+            }
+            if (*p == '"') return(Variant(parseString()));
+            if (strncmp(p, "true", 4) == 0) { p += 4; return(Variant(true)); }
+            if (strncmp(p, "false", 5) == 0) { p += 5; return(Variant(false)); }
+            if (strncmp(p, "null", 4) == 0) { p += 4; return(Variant()); }
+            // number
+            const char* start = p;
+            bool real = false;
+            if (*p == '-') p++;
+            while ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-') {
+                if (*p == '.' || *p == 'e' || *p == 'E') real = true;
+                p++;
+            }
+            if (p == start) { ok = false; return(Variant()); }
+            std::string number(start, p - start);
+            if (real) return(Variant(strtod(number.c_str(), nullptr)));
+            long long value = strtoll(number.c_str(), nullptr, 10);
+            if (value >= INT32_MIN && value <= INT32_MAX) return(Variant((int) value));
+            return(Variant(value));
+        }
+    };
+}
+
+Variant Variant::fromJSON(const char* json) {
+    if (json == nullptr) return(Variant());
+    JSONParser parser{json};
+    Variant value = parser.parseValue();
+    if (!parser.ok) return(Variant());
+    return(value);
+}
+
+/*** logging ***/
+
+static LogLevel s_log_level = LOG_LEVEL_INFO;
+static std::mutex s_log_mutex;
+
+void host::setLogLevel(LogLevel level) { s_log_level = level; }
+
+SerialLogHandler::SerialLogHandler(LogLevel level) { s_log_level = level; }
+SerialLogHandler::SerialLogHandler(LogLevel level, std::initializer_list<std::pair<const char*, LogLevel>> categories) {
+    s_log_level = level;
+    for (const auto& category : categories) {
+        if (strcmp(category.first, "app") == 0) s_log_level = category.second;
+    }
+}
+
+Logger Log;
+
+void Logger::log(LogLevel level, const char* fmt, va_list args) const {
+    if (level < s_log_level) return;
+    const char* label = level >= LOG_LEVEL_ERROR ? "ERROR" : level >= LOG_LEVEL_WARN ? "WARN" : level >= LOG_LEVEL_INFO ? "INFO" : "TRACE";
+    std::lock_guard<std::mutex> lock(s_log_mutex);
+    ::printf("%010lu [%s] %s: ", millis(), name, label);
+    vprintf(fmt, args);
+    ::printf("\n");
+}
+
+#define HOST_LOG(level) { va_list args; va_start(args, fmt); log(level, fmt, args); va_end(args); }
+void Logger::trace(const char* fmt, ...) const HOST_LOG(LOG_LEVEL_TRACE)
+void Logger::info(const char* fmt, ...) const HOST_LOG(LOG_LEVEL_INFO)
+void Logger::warn(const char* fmt, ...) const HOST_LOG(LOG_LEVEL_WARN)
+void Logger::error(const char* fmt, ...) const HOST_LOG(LOG_LEVEL_ERROR)
+
+void Logger::print(const char* text) const {
+    if (s_log_level > LOG_LEVEL_INFO) return;
+    std::lock_guard<std::mutex> lock(s_log_mutex);
+    fputs(text, stdout);
+}
+
+void Logger::printf(const char* fmt, ...) const {
+    if (s_log_level > LOG_LEVEL_INFO) return;
+    std::lock_guard<std::mutex> lock(s_log_mutex);
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+bool Logger::isTraceEnabled() const { return(s_log_level <= LOG_LEVEL_TRACE); }
+bool Logger::isInfoEnabled() const { return(s_log_level <= LOG_LEVEL_INFO); }
+bool Logger::isWarnEnabled() const { return(s_log_level <= LOG_LEVEL_WARN); }
+
+/*** time ***/
+
+// the clock starts at 1 s, like a device that just booted (the library uses 0 as 'never')
+static const auto s_start = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+
+unsigned long millis() {
+    return(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - s_start).count());
+}
+
+unsigned long micros() {
+    return(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_start).count());
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    // busy wait like the device (sleeping would add the scheduler's wake up latency to every short delay)
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while (std::chrono::steady_clock::now() < end);
+}
+
+TimeClass Time;
+
+time_t TimeClass::now() { return(time(nullptr)); }
+
+String TimeClass::format(time_t t, const char* fmt) {
+    char buffer[128];
+    struct tm parts;
+    gmtime_r(&t, &parts);
+    // %Z of the device is the (UTC) offset name, the host formats UTC too
+    std::string pattern(fmt);
+    for (size_t j = pattern.find("%Z"); j != std::string::npos; j = pattern.find("%Z")) pattern.replace(j, 2, "UTC");
+    strftime(buffer, sizeof(buffer), pattern.c_str(), &parts);
+    return(buffer);
+}
+
+/*** random ***/
+
+static std::mt19937 s_random;
+
+long random(long max) {
+    if (max <= 0) return(0);
+    return(s_random() % max);
+}
+
+long random(long min, long max) {
+    if (min >= max) return(min);
+    return(min + random(max - min));
+}
+
+void randomSeed(unsigned int seed) { s_random.seed(seed); }
+
+/*** system and cloud ***/
+
+SystemClass System;
+CloudClass Particle;
+
+int CloudClass::call(const char* name, const String& arg) {
+    for (auto& function : functions) {
+        if (function.first == name) return(function.second(arg));
+    }
+    return(-1);
+}
+
+String CloudClass::read(const char* name) {
+    for (auto& variable : variables) {
+        if (variable.first == name) return(variable.second());
+    }
+    return(String());
+}
+
+/*** I2C ***/
+
+TwoWire Wire;
+
+TwoWire::Target* TwoWire::find(uint8_t address) {
+    for (auto& target : targets) {
+        if (target.address == address) return(&target);
+    }
+    return(nullptr);
+}
+
+void TwoWire::attach(uint8_t address, std::function<bool(const uint8_t*, size_t)> write, std::function<size_t(uint8_t*, size_t)> read) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    detach(address);
+    targets.append({address, write, read});
+}
+
+void TwoWire::detach(uint8_t address) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (int i = 0; i < targets.size(); i++) {
+        if (targets[i].address == address) {
+            targets.removeAt(i);
+            return;
+        }
+    }
+}
+
+uint8_t TwoWire::endTransmission(bool stop) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!enabled) return(2);
+    if (tx.size() > I2C_BUFFER_LENGTH) return(1);
+    Target* target = find(tx_address);
+    if (target == nullptr) return(2);
+    return(target->write(tx.data(), tx.size()) ? 0 : 3);
+}
+
+size_t TwoWire::requestFrom(uint8_t address, size_t n, uint8_t stop) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    rx_length = 0;
+    rx_pos = 0;
+    Target* target = find(address);
+    if (!enabled || target == nullptr) return(0);
+    rx_length = target->read(rx, std::min(n, (size_t) I2C_BUFFER_LENGTH));
+    return(rx_length);
+}
+
+/*** RTOS and HAL ***/
+
+int HAL_Core_Runtime_Info(runtime_info_t* info, void* reserved) {
+    info->freeheap = System.freeMemory();
+    info->largest_free_block_heap = info->freeheap;
+    info->total_heap = host::heap_size;
+    return(0);
+}
+
+/*** Print ***/
+
+size_t Print::printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    if (n <= 0) return(0);
+    std::string text(n, '\0');
+    va_start(args, fmt);
+    vsnprintf(&text[0], n + 1, fmt, args);
+    va_end(args);
+    return(write((const uint8_t*) text.data(), text.size()));
+}
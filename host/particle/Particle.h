@@ -0,0 +1,640 @@
+#pragma once
+
+/**
+ * @brief host stand-in for the parts of Device OS (Particle.h) the LoggerCore classes use, so they can be compiled
+ * and run on a Linux/macOS host (see the host tasks in the Rakefile), it is not a device simulator:
+ * - String, Vector and Variant (with JSON) behave like their Device OS counterparts for what the library uses
+ * - Log prints to stdout, millis()/micros()/delay() use the host clock, Time.now() is the host time
+ * - System.freeMemory() is a fixed heap (the RAM of the platform) minus the bytes allocated with new on the host
+ * - the cloud (Particle.function/variable/publish) only records what is registered
+ * - Wire routes transactions to host devices attached to an address (e.g. the LoggerSDEmulator, see host/sd)
+ * - host:: counts heap allocations (all operator new calls) and Variant copies for measurements
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstdarg>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <limits>
+#include <string>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include <chrono>
+#include <initializer_list>
+
+using namespace std::chrono_literals;
+
+/*** platform ***/
+
+typedef unsigned int uint;
+typedef uint8_t byte;
+typedef uint32_t system_tick_t;
+
+#define PLATFORM_PHOTON 6
+#define PLATFORM_ARGON 12
+#define PLATFORM_BORON 13
+#define PLATFORM_P2 32
+#ifndef PLATFORM_ID
+#define PLATFORM_ID PLATFORM_P2
+#endif
+#define PLATFORM_THREADING 1
+#define HAL_PLATFORM_FILESYSTEM 1
+#define SYSTEM_VERSION_630
+
+#define SYSTEM_THREAD(mode)
+#define SYSTEM_MODE(mode)
+
+namespace particle { namespace protocol { const size_t MAX_FUNCTION_ARG_LENGTH = 1024; } }
+
+/*** String ***/
+
+class String {
+
+    private:
+
+        std::string s;
+
+    public:
+
+        String() {}
+        String(const char* text) : s(text != nullptr ? text : "") {}
+        String(const char* text, unsigned length) : s(text, length) {}
+        String(const std::string& text) : s(text) {}
+        explicit String(char c) : s(1, c) {}
+        String(int value) : s(std::to_string(value)) {}
+        String(unsigned value) : s(std::to_string(value)) {}
+        String(long value) : s(std::to_string(value)) {}
+        String(unsigned long value) : s(std::to_string(value)) {}
+        String(long long value) : s(std::to_string(value)) {}
+        String(unsigned long long value) : s(std::to_string(value)) {}
+        String(float value, int decimals = 2) : String((double) value, decimals) {}
+        String(double value, int decimals = 2) {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+            s = buffer;
+        }
+
+        static String format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+        const char* c_str() const { return(s.c_str()); }
+        unsigned length() const { return(s.length()); }
+        bool reserve(unsigned size) { s.reserve(size); return(true); }
+
+        String& operator+=(const String& other) { s += other.s; return(*this); }
+        String& operator+=(const char* other) { if (other != nullptr) s += other; return(*this); }
+        String& operator+=(char c) { s += c; return(*this); }
+        String& operator+=(int value) { s += std::to_string(value); return(*this); }
+        String& operator+=(unsigned value) { s += std::to_string(value); return(*this); }
+        String& operator+=(long value) { s += std::to_string(value); return(*this); }
+        String& operator+=(unsigned long value) { s += std::to_string(value); return(*this); }
+        bool concat(const String& other) { s += other.s; return(true); }
+        bool concat(const char* other) { if (other != nullptr) s += other; return(true); }
+        bool concat(char c) { s += c; return(true); }
+
+        friend String operator+(const String& a, const String& b) { String r(a); r += b; return(r); }
+        friend String operator+(const String& a, const char* b) { String r(a); r += b; return(r); }
+        friend String operator+(const char* a, const String& b) { String r(a); r += b; return(r); }
+        friend String operator+(const String& a, char b) { String r(a); r += b; return(r); }
+
+        bool operator==(const String& other) const { return(s == other.s); }
+        bool operator==(const char* other) const { return(s == (other != nullptr ? other : "")); }
+        bool operator!=(const String& other) const { return(s != other.s); }
+        bool operator!=(const char* other) const { return(!(*this == other)); }
+        bool operator<(const String& other) const { return(s < other.s); }
+        bool equals(const String& other) const { return(s == other.s); }
+        bool equals(const char* other) const { return(*this == other); }
+        bool equalsIgnoreCase(const String& other) const { return(strcasecmp(c_str(), other.c_str()) == 0); }
+        int compareTo(const String& other) const { return(s.compare(other.s)); }
+        bool startsWith(const String& prefix) const { return(s.compare(0, prefix.s.length(), prefix.s) == 0); }
+        bool endsWith(const String& suffix) const {
+            return(s.length() >= suffix.s.length() && s.compare(s.length() - suffix.s.length(), suffix.s.length(), suffix.s) == 0);
+        }
+
+        char operator[](unsigned i) const { return(i < s.length() ? s[i] : '\0'); }
+        char& operator[](unsigned i) { return(s[i]); }
+        char charAt(unsigned i) const { return((*this)[i]); }
+        void setCharAt(unsigned i, char c) { if (i < s.length()) s[i] = c; }
+
+        int indexOf(char c, unsigned from = 0) const { size_t i = s.find(c, from); return(i == std::string::npos ? -1 : (int) i); }
+        int indexOf(const String& text, unsigned from = 0) const { size_t i = s.find(text.s, from); return(i == std::string::npos ? -1 : (int) i); }
+        int lastIndexOf(char c) const { size_t i = s.rfind(c); return(i == std::string::npos ? -1 : (int) i); }
+        String substring(unsigned from) const { return(from < s.length() ? String(s.substr(from)) : String()); }
+        String substring(unsigned from, unsigned to) const {
+            if (from > to) std::swap(from, to);
+            return(from < s.length() ? String(s.substr(from, to - from)) : String());
+        }
+
+        String& remove(unsigned index) { if (index < s.length()) s.erase(index); return(*this); }
+        String& remove(unsigned index, unsigned count) { if (index < s.length()) s.erase(index, count); return(*this); }
+        String& replace(const String& find, const String& with) {
+            if (find.s.empty()) return(*this);
+            for (size_t i = s.find(find.s); i != std::string::npos; i = s.find(find.s, i + with.s.length())) s.replace(i, find.s.length(), with.s);
+            return(*this);
+        }
+        String& toLowerCase() { for (char& c : s) c = tolower(c); return(*this); }
+        String& toUpperCase() { for (char& c : s) c = toupper(c); return(*this); }
+        String& trim() {
+            size_t first = s.find_first_not_of(" \t\r\n");
+            size_t last = s.find_last_not_of(" \t\r\n");
+            s = first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+            return(*this);
+        }
+
+        long toInt() const { return(atol(c_str())); }
+        float toFloat() const { return(atof(c_str())); }
+        double toDouble() const { return(atof(c_str())); }
+};
+
+/*** Vector ***/
+
+template <typename T>
+class Vector {
+
+    private:
+
+        std::vector<T> v;
+
+    public:
+
+        Vector() {}
+        explicit Vector(int n) : v(n) {}
+        Vector(int n, const T& value) : v(n, value) {}
+        Vector(std::initializer_list<T> values) : v(values) {}
+
+        bool append(const T& value) { v.push_back(value); return(true); }
+        bool append(T&& value) { v.push_back(std::move(value)); return(true); }
+        bool append(const Vector<T>& values) { v.insert(v.end(), values.v.begin(), values.v.end()); return(true); }
+        bool prepend(const T& value) { v.insert(v.begin(), value); return(true); }
+        bool insert(int i, const T& value) { v.insert(v.begin() + i, value); return(true); }
+        bool insert(int i, T&& value) { v.insert(v.begin() + i, std::move(value)); return(true); }
+        void removeAt(int i) { v.erase(v.begin() + i); }
+        bool removeOne(const T& value) { int i = indexOf(value); if (i < 0) return(false); removeAt(i); return(true); }
+        T takeAt(int i) { T value = std::move(v[i]); v.erase(v.begin() + i); return(value); }
+        T takeFirst() { return(takeAt(0)); }
+        T takeLast() { T value = std::move(v.back()); v.pop_back(); return(value); }
+
+        int size() const { return(v.size()); }
+        bool isEmpty() const { return(v.empty()); }
+        void clear() { v.clear(); }
+        bool reserve(int n) { v.reserve(n); return(true); }
+        int capacity() const { return(v.capacity()); }
+        bool resize(int n) { v.resize(n); return(true); }
+        void trimToSize() { v.shrink_to_fit(); }
+
+        T& operator[](int i) { return(v[i]); }
+        const T& operator[](int i) const { return(v[i]); }
+        T& at(int i) { return(v.at(i)); }
+        const T& at(int i) const { return(v.at(i)); }
+        T& first() { return(v.front()); }
+        const T& first() const { return(v.front()); }
+        T& last() { return(v.back()); }
+        const T& last() const { return(v.back()); }
+        T* data() { return(v.data()); }
+        const T* data() const { return(v.data()); }
+
+        int indexOf(const T& value, int from = 0) const {
+            for (int i = from; i < (int) v.size(); i++) if (v[i] == value) return(i);
+            return(-1);
+        }
+        bool contains(const T& value) const { return(indexOf(value) >= 0); }
+
+        typename std::vector<T>::iterator begin() { return(v.begin()); }
+        typename std::vector<T>::iterator end() { return(v.end()); }
+        typename std::vector<T>::const_iterator begin() const { return(v.begin()); }
+        typename std::vector<T>::const_iterator end() const { return(v.end()); }
+};
+
+/*** Variant ***/
+
+class Variant;
+typedef Vector<Variant> VariantArray;
+typedef Vector<std::pair<String, Variant>> VariantMap; // insertion order
+
+class Variant {
+
+    public:
+
+        enum Type { NULL_, BOOL, INT, UINT, INT64, UINT64, DOUBLE, STRING, ARRAY, MAP };
+
+    private:
+
+        Type t = NULL_;
+        bool b = false;
+        int64_t i = 0;
+        uint64_t u = 0;
+        double d = 0;
+        String s;
+        std::unique_ptr<VariantArray> a;
+        std::unique_ptr<VariantMap> m;
+
+        void copyFrom(const Variant& other);
+        VariantMap& map(); // converts to a map if it is not one
+        VariantArray& array(); // converts to an array if it is not one
+        const Variant* find(const char* key) const;
+
+    public:
+
+        Variant() {}
+        Variant(bool value) : t(BOOL), b(value) {}
+        Variant(int value) : t(INT), i(value) {}
+        Variant(unsigned value) : t(UINT), u(value) {}
+        Variant(long value) : t(INT64), i(value) {}
+        Variant(unsigned long value) : t(UINT64), u(value) {}
+        Variant(long long value) : t(INT64), i(value) {}
+        Variant(unsigned long long value) : t(UINT64), u(value) {}
+        Variant(float value) : t(DOUBLE), d(value) {}
+        Variant(double value) : t(DOUBLE), d(value) {}
+        Variant(const char* value) : t(STRING), s(value) {}
+        Variant(const String& value) : t(STRING), s(value) {}
+        Variant(String&& value) : t(STRING), s(std::move(value)) {}
+        Variant(const VariantArray& value);
+        Variant(VariantArray&& value);
+        Variant(const VariantMap& value);
+        Variant(const Variant& other);
+        Variant(Variant&& other) noexcept;
+        Variant& operator=(const Variant& other);
+        Variant& operator=(Variant&& other) noexcept;
+        ~Variant();
+
+        Type type() const { return(t); }
+        bool isNull() const { return(t == NULL_); }
+        bool isBool() const { return(t == BOOL); }
+        bool isInt() const { return(t == INT); }
+        bool isUInt() const { return(t == UINT); }
+        bool isInt64() const { return(t == INT64); }
+        bool isUInt64() const { return(t == UINT64); }
+        bool isDouble() const { return(t == DOUBLE); }
+        bool isNumber() const { return(t >= INT && t <= DOUBLE); }
+        bool isString() const { return(t == STRING); }
+        bool isArray() const { return(t == ARRAY); }
+        bool isMap() const { return(t == MAP); }
+
+        // conversions (numbers from strings are parsed, containers convert to 0/empty)
+        bool toBool() const;
+        int toInt() const { return((int) toInt64()); }
+        unsigned toUInt() const { return((unsigned) toUInt64()); }
+        int64_t toInt64() const;
+        uint64_t toUInt64() const;
+        float toFloat() const { return((float) toDouble()); }
+        double toDouble() const;
+        String toString() const;
+
+        // convert in place and return a reference to the value
+        bool& asBool() { b = toBool(); t = BOOL; return(b); }
+        int& asInt();
+        double& asDouble() { d = toDouble(); t = DOUBLE; return(d); }
+        String& asString() { s = toString(); t = STRING; a.reset(); m.reset(); return(s); }
+        VariantArray& asArray() { return(array()); }
+        VariantMap& asMap() { return(map()); }
+
+        // containers
+        int size() const;
+        bool isEmpty() const;
+        void clear() { *this = Variant(); }
+
+        // arrays
+        bool append(const Variant& value) { array().append(value); return(true); }
+        bool append(Variant&& value) { array().append(std::move(value)); return(true); }
+        bool prepend(const Variant& value) { array().prepend(value); return(true); }
+        bool insertAt(int index, const Variant& value) { array().insert(index, value); return(true); }
+        void removeAt(int index) { if (t == ARRAY && index >= 0 && index < a->size()) a->removeAt(index); }
+        Variant at(int index) const { return(t == ARRAY && index >= 0 && index < a->size() ? (*a)[index] : Variant()); }
+        Variant& operator[](int index) { return(array()[index]); }
+
+        // maps
+        bool set(const char* key, const Variant& value);
+        bool set(const char* key, Variant&& value);
+        bool set(const String& key, const Variant& value) { return(set(key.c_str(), value)); }
+        bool set(const String& key, Variant&& value) { return(set(key.c_str(), std::move(value))); }
+        Variant get(const char* key) const { const Variant* v = find(key); return(v != nullptr ? *v : Variant()); }
+        Variant get(const String& key) const { return(get(key.c_str())); }
+        bool has(const char* key) const { return(find(key) != nullptr); }
+        bool has(const String& key) const { return(has(key.c_str())); }
+        bool remove(const char* key);
+        bool remove(const String& key) { return(remove(key.c_str())); }
+        Variant& operator[](const char* key);
+        Variant& operator[](const String& key) { return((*this)[key.c_str()]); }
+
+        bool operator==(const Variant& other) const;
+        bool operator!=(const Variant& other) const { return(!(*this == other)); }
+
+        // JSON
+        String toJSON() const;
+        static Variant fromJSON(const char* json);
+        static Variant fromJSON(const String& json) { return(fromJSON(json.c_str())); }
+};
+
+/*** logging ***/
+
+enum LogLevel {
+    LOG_LEVEL_ALL = 1,
+    LOG_LEVEL_TRACE = 1,
+    LOG_LEVEL_INFO = 30,
+    LOG_LEVEL_WARN = 40,
+    LOG_LEVEL_ERROR = 50,
+    LOG_LEVEL_NONE = 70
+};
+
+class Logger {
+
+    private:
+
+        const char* name;
+        void log(LogLevel level, const char* fmt, va_list args) const;
+
+    public:
+
+        Logger(const char* name = "app") : name(name) {}
+        void trace(const char* fmt, ...) const __attribute__((format(printf, 2, 3)));
+        void info(const char* fmt, ...) const __attribute__((format(printf, 2, 3)));
+        void warn(const char* fmt, ...) const __attribute__((format(printf, 2, 3)));
+        void error(const char* fmt, ...) const __attribute__((format(printf, 2, 3)));
+        void print(const char* text) const;
+        void printf(const char* fmt, ...) const __attribute__((format(printf, 2, 3)));
+        bool isTraceEnabled() const;
+        bool isInfoEnabled() const;
+        bool isWarnEnabled() const;
+};
+extern Logger Log;
+
+// sets the level of the host log (the last handler constructed wins, the "app" category level if one is given)
+struct SerialLogHandler {
+    SerialLogHandler(LogLevel level = LOG_LEVEL_INFO);
+    SerialLogHandler(LogLevel level, std::initializer_list<std::pair<const char*, LogLevel>> categories);
+};
+
+/*** time ***/
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+struct TimeClass {
+    time_t now();
+    bool isValid() { return(true); }
+    String format(time_t t, const char* fmt);
+    String timeStr(time_t t) { return(format(t, "%a %b %d %H:%M:%S %Y")); }
+};
+extern TimeClass Time;
+
+/*** random ***/
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned int seed);
+
+/*** system ***/
+
+enum system_event_t { out_of_memory = 1 };
+
+struct SystemClass {
+    uint32_t freeMemory();
+    String version() { return("host"); }
+    String deviceID() { return("0123456789abcdef01234567"); }
+    uint32_t ticks() { return((uint32_t) micros()); }
+    void reset() { exit(0); }
+    void on(system_event_t, void (*)(system_event_t, int)) {}
+};
+extern SystemClass System;
+
+/*** cloud ***/
+
+struct CloudDisconnectOptions {
+    CloudDisconnectOptions& graceful(bool) { return(*this); }
+    CloudDisconnectOptions& timeout(int) { return(*this); }
+};
+
+class CloudClass {
+
+    public:
+
+        // registered cloud functions and variables (by name)
+        Vector<std::pair<String, std::function<int(String)>>> functions;
+        Vector<std::pair<String, std::function<String()>>> variables;
+        bool is_connected = false;
+
+        template <typename T>
+        bool function(const char* name, int (T::*method)(String), T* instance) {
+            functions.append({name, [instance, method](String arg) { return((instance->*method)(arg)); }});
+            return(true);
+        }
+        bool function(const char* name, int (*handler)(String)) {
+            functions.append({name, handler});
+            return(true);
+        }
+        bool variable(const char* name, const char* value) {
+            variables.append({name, [value]() { return(String(value)); }});
+            return(true);
+        }
+        bool variable(const char* name, const String& value) {
+            variables.append({name, [&value]() { return(value); }});
+            return(true);
+        }
+        template <typename T>
+        bool variable(const char* name, String (T::*method)(), T* instance) {
+            variables.append({name, [instance, method]() { return((instance->*method)()); }});
+            return(true);
+        }
+        bool variable(const char* name, std::function<String()> fn) {
+            variables.append({name, fn});
+            return(true);
+        }
+
+        // call a registered function / read a registered variable (-1 / empty if not registered)
+        int call(const char* name, const String& arg);
+        String read(const char* name);
+
+        bool connected() { return(is_connected); }
+        bool connect() { is_connected = true; return(true); }
+        bool disconnect() { is_connected = false; return(true); }
+        void setDisconnectOptions(const CloudDisconnectOptions&) {}
+        bool publish(const char*, const char* = nullptr) { return(is_connected); }
+};
+extern CloudClass Particle;
+
+/*** Print ***/
+
+class Print {
+
+    public:
+
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) {
+            size_t n = 0;
+            while (size--) n += write(*buffer++);
+            return(n);
+        }
+        size_t write(const char* text) { return(text != nullptr ? write((const uint8_t*) text, strlen(text)) : 0); }
+        size_t print(const char* text) { return(write(text)); }
+        size_t print(const String& text) { return(write(text.c_str())); }
+        size_t print(char c) { return(write((uint8_t) c)); }
+        size_t print(int value) { return(print(String(value))); }
+        size_t print(unsigned value) { return(print(String(value))); }
+        size_t print(long value) { return(print(String(value))); }
+        size_t print(unsigned long value) { return(print(String(value))); }
+        size_t print(double value, int decimals = 2) { return(print(String(value, decimals))); }
+        size_t println() { return(write("\r\n")); }
+        template <typename T> size_t println(const T& value) { return(print(value) + println()); }
+        size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual void flush() = 0;
+};
+
+/*** I2C ***/
+
+#define CLOCK_SPEED_100KHZ 100000
+#define CLOCK_SPEED_400KHZ 400000
+#define I2C_BUFFER_LENGTH 32
+
+class WireTransmission {
+
+    public:
+
+        uint8_t address;
+        size_t size = 0;
+        system_tick_t ms = 0;
+        bool stop_after = true;
+
+        WireTransmission(uint8_t address) : address(address) {}
+        WireTransmission& timeout(system_tick_t ms) { this->ms = ms; return(*this); }
+        WireTransmission& timeout(std::chrono::milliseconds ms) { return(timeout((system_tick_t) ms.count())); }
+        WireTransmission& quantity(size_t size) { this->size = size; return(*this); }
+        WireTransmission& stop(bool stop) { stop_after = stop; return(*this); }
+};
+
+/**
+ * @brief host bus: a write transaction (the bytes between beginTransmission() and endTransmission()) and a read
+ * transaction (requestFrom()) go to the target attached at the address, any other address does not acknowledge,
+ * a target's write handler gets the transaction's bytes (none for an address probe) and returns whether it acknowledged,
+ * its read handler fills up to n bytes and returns how many it sent
+ */
+class TwoWire : public Stream {
+
+    private:
+
+        struct Target {
+            uint8_t address;
+            std::function<bool(const uint8_t*, size_t)> write;
+            std::function<size_t(uint8_t*, size_t)> read;
+        };
+
+        Vector<Target> targets;
+        std::recursive_mutex mutex;
+        bool enabled = false;
+        uint32_t speed = CLOCK_SPEED_100KHZ;
+        uint8_t tx_address = 0;
+        std::vector<uint8_t> tx;
+        uint8_t rx[I2C_BUFFER_LENGTH];
+        size_t rx_length = 0;
+        size_t rx_pos = 0;
+
+        Target* find(uint8_t address);
+
+    public:
+
+        // connect a (host) device to the bus
+        void attach(uint8_t address, std::function<bool(const uint8_t*, size_t)> write, std::function<size_t(uint8_t*, size_t)> read);
+        void detach(uint8_t address);
+
+        // bus lock (recursive, like the Device OS one)
+        bool lock() { mutex.lock(); return(true); }
+        bool unlock() { mutex.unlock(); return(true); }
+
+        void begin() { enabled = true; }
+        void end() { enabled = false; }
+        bool isEnabled() { return(enabled); }
+        void setSpeed(uint32_t speed) { this->speed = speed; }
+        uint32_t getSpeed() { return(speed); }
+
+        void beginTransmission(uint8_t address) { tx_address = address; tx.clear(); }
+        void beginTransmission(const WireTransmission& transmission) { beginTransmission(transmission.address); }
+        // 0 = acknowledged, 1 = more than I2C_BUFFER_LENGTH bytes, 2 = address not acknowledged, 3 = data not acknowledged
+        uint8_t endTransmission(bool stop = true);
+        size_t requestFrom(uint8_t address, size_t n, uint8_t stop = true);
+        size_t requestFrom(const WireTransmission& transmission) { return(requestFrom(transmission.address, transmission.size)); }
+
+        size_t write(uint8_t c) override { tx.push_back(c); return(1); }
+        size_t write(const uint8_t* buffer, size_t size) override { tx.insert(tx.end(), buffer, buffer + size); return(size); }
+        using Print::write;
+        int available() override { return(rx_length - rx_pos); }
+        int read() override { return(rx_pos < rx_length ? rx[rx_pos++] : -1); }
+        int peek() override { return(rx_pos < rx_length ? rx[rx_pos] : -1); }
+        void flush() override {}
+};
+extern TwoWire Wire;
+
+/*** RTOS and HAL ***/
+
+typedef struct {
+    uint16_t size;
+    uint16_t flags;
+    uint32_t freeheap;
+    uint32_t system_version;
+    uint32_t total_init_heap;
+    uint32_t total_heap;
+    uint32_t max_used_heap;
+    uint32_t user_static_ram;
+    uint32_t largest_free_block_heap;
+} runtime_info_t;
+
+// free heap and largest block are both the host free memory (System.freeMemory(), no fragmentation)
+int HAL_Core_Runtime_Info(runtime_info_t* info, void* reserved);
+
+typedef void* os_thread_t;
+typedef int os_result_t;
+#define OS_THREAD_INVALID_HANDLE nullptr
+typedef struct {
+    uint16_t size;
+    uint16_t reserved;
+    os_thread_t thread;
+    const char* name;
+    uint32_t id;
+    uint32_t priority;
+    uint32_t base_priority;
+    void* stack_base;
+    void* stack_current;
+    uintptr_t stack_high_watermark;
+    void* stack_end;
+} os_thread_dump_info_t;
+typedef os_result_t (*os_thread_dump_callback_t)(os_thread_dump_info_t* info, void* data);
+
+// the host has no RTOS threads to report
+inline os_result_t os_thread_dump(os_thread_t thread, os_thread_dump_callback_t callback, void* data) { return(0); }
+
+/*** host measurements ***/
+
+namespace host {
+
+    // heap allocations (operator new) and bytes currently allocated
+    uint32_t getAllocations();
+    size_t getAllocatedBytes();
+
+    // copies of Variants (copy construction/assignment, nested values included) and of Variant maps only
+    // (e.g. call records, which are maps)
+    uint32_t getVariantCopies();
+    uint32_t getMapCopies();
+
+    // log level of the host log (see SerialLogHandler)
+    void setLogLevel(LogLevel level);
+
+    // heap the free memory is computed from (System.freeMemory() = heap - allocated bytes)
+    inline size_t heap_size = 3 * 1024 * 1024;
+}
@@ -0,0 +1,262 @@
+/**
+ * host run of the SD card code (LoggerSD, LoggerSDLog) against the OpenLog emulator (LoggerSDEmulator) in a temporary
+ * directory: the emulator is attached to the host I2C bus (Wire) at the OpenLog address so the writes go through
+ * LoggerSDWirePort and the LoggerI2C queue like on the device, checks record framing, batching, recovery after a
+ * restart (also with a damaged tail), reconnection after card removal, failed syncs, random bus failures, log segment
+ * rotation/retention/export and the flash usage tracking of the emulator, then measures throughput with the latency model
+ * usage: rake host:sd [LOG=trace]
+ * exits with 1 if any check fails
+ */
+
+#include "Particle.h"
+#include "LoggerPlatform.h"
+#include "LoggerSD.h"
+#include "LoggerSDLog.h"
+#include "LoggerSDEmulator.h"
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+// checks
+size_t checks = 0;
+size_t failures = 0;
+
+void check(bool condition, const char* what) {
+    checks++;
+    if (!condition) {
+        failures++;
+        Log.error("CHECK: %s failed", what);
+    } else {
+        Log.trace("CHECK: %s", what);
+    }
+}
+
+// files of the emulated card (read directly from the host file system)
+String card;
+
+String readCard(const char* file) {
+    std::ifstream in((String(card) + "/" + file).c_str(), std::ios::binary);
+    std::stringstream content;
+    content << in.rdbuf();
+    return(String(content.str()));
+}
+
+void appendCard(const char* file, const char* text) {
+    std::ofstream out((String(card) + "/" + file).c_str(), std::ios::binary | std::ios::app);
+    out << text;
+}
+
+// framed records of a file: valid ones (with their sequence numbers) and damaged lines (same rules as rake sdlog)
+struct Frames {
+    Vector<uint32_t> seqs;
+    size_t damaged = 0;
+};
+
+Frames parseFrames(const String& content) {
+    Frames frames;
+    int start = 0;
+    while (start < (int) content.length()) {
+        int end = content.indexOf('\n', start);
+        if (end < 0) end = content.length();
+        String line = content.substring(start, end);
+        start = end + 1;
+        if (line.length() == 0 || line.startsWith("~sync ")) continue;
+        unsigned long seq, length, crc;
+        int header = 0;
+        if (sscanf(line.c_str(), "#%lu:%lu:%8lx:%n", &seq, &length, &crc, &header) == 3 && header > 0 &&
+            line.length() - header == length && LoggerSD::crc32((const uint8_t*) line.c_str() + header, length) == crc) {
+            frames.seqs.append(seq);
+        } else {
+            frames.damaged++;
+        }
+    }
+    return(frames);
+}
+
+bool isSequence(const Vector<uint32_t>& seqs, uint32_t first) {
+    for (int i = 0; i < seqs.size(); i++) {
+        if (seqs[i] != first + i) return(false);
+    }
+    return(true);
+}
+
+// collects an export
+class Collector : public Print {
+    public:
+        String text;
+        size_t write(uint8_t c) override { text += (char) c; return(1); }
+};
+
+int main() {
+
+    host::setLogLevel(getenv("LOG") && strcmp(getenv("LOG"), "trace") == 0 ? LOG_LEVEL_TRACE : LOG_LEVEL_INFO);
+
+    // emulated card in a temporary directory
+    char dir[] = "/tmp/loggersd_XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        Log.error("cannot create a temporary directory");
+        return(1);
+    }
+    card = dir;
+    LoggerSDEmulator emulator(dir);
+    emulator.setLatency(0, 0);
+
+    // the emulator on the bus at the OpenLog address (its latency model follows the bus clock)
+    Wire.attach(0x2a,
+        [&](const uint8_t* bytes, size_t n) {
+            emulator.setClockSpeed(Wire.getSpeed());
+            return(n == 0 ? emulator.ping() : emulator.transmit(bytes[0], bytes + 1, n - 1));
+        },
+        [&](uint8_t* data, size_t n) {
+            emulator.setClockSpeed(Wire.getSpeed());
+            return(emulator.receive(data, n));
+        });
+    LoggerI2C::discover();
+    check(LoggerI2C::isPresent(0x2a), "emulator responds on the bus");
+
+    // flash usage tracking starts from a measurement (nothing on the host)
+    float flash_before = LoggerPlatform::getUsedFlash();
+
+    // records
+    {
+        LoggerSD sd;
+        sd.init();
+        check(sd.available(), "card available after init()");
+        size_t n = 200;
+        for (size_t i = 0; i < n; i++) sd.appendRecord("rec.log", String::format("{\"i\":%d,\"v\":%.3f}", (int) i, i * 0.5).c_str());
+        check(sd.syncFile(), "sync after appending records");
+        Frames frames = parseFrames(readCard("rec.log"));
+        check(frames.seqs.size() == (int) n && frames.damaged == 0, "all records on the card are valid");
+        check(isSequence(frames.seqs, 0), "record sequence numbers are consecutive");
+        check(sd.size("rec.log") == (int32_t) readCard("rec.log").length(), "size() matches the file");
+        Variant stats = emulator.getStats();
+        // batching: far fewer transactions than bytes
+        check(stats.get("transactions").toInt() * 8 < stats.get("bytes").toInt(), "writes are batched into full I2C transactions");
+        Log.info("SD: %d records in %d transactions (%d B)", (int) n, stats.get("transactions").toInt(), stats.get("bytes").toInt());
+    }
+
+    // recovery after a restart, also with a damaged tail
+    {
+        LoggerSD sd;
+        sd.init();
+        sd.appendRecord("rec.log", "{\"after\":\"restart\"}");
+        sd.syncFile();
+        check(sd.getRecordSeq() == 201, "sequence continues after a restart");
+        appendCard("rec.log", "#201:40:deadbeef:{\"truncated");
+    }
+    {
+        LoggerSD sd;
+        sd.init();
+        sd.appendRecord("rec.log", "{\"after\":\"damage\"}");
+        sd.syncFile();
+        Frames frames = parseFrames(readCard("rec.log"));
+        check(frames.damaged == 1, "damaged tail detected");
+        check(frames.seqs.size() == 202 && frames.seqs.last() == 201, "sequence continues after the last valid record");
+    }
+
+    // card removal and reconnection
+    {
+        LoggerSD sd;
+        sd.init();
+        emulator.removeCard();
+        for (size_t i = 0; i < 3 && sd.available(); i++) {
+            sd.appendRecord("rec.log", "{\"card\":\"removed\"}");
+            sd.syncFile();
+        }
+        check(!sd.available(), "card absent after failures in a row");
+        emulator.insertCard();
+        unsigned long start = millis();
+        while (!sd.available() && millis() - start < 5000) {
+            sd.loop();
+            LoggerI2C::loop();
+            delay(10);
+        }
+        check(sd.available(), "card reconnected from loop()");
+        check(sd.appendRecord("rec.log", "{\"card\":\"back\"}") > 0 && sd.syncFile(), "writing after the reconnection");
+        Frames frames = parseFrames(readCard("rec.log"));
+        check(isSequence(frames.seqs, 0), "no sequence number reused after the reconnection");
+    }
+
+    // failed syncs
+    {
+        LoggerSD sd;
+        sd.init();
+        sd.appendRecord("sync.log", "{\"sync\":1}");
+        emulator.failSyncs(1);
+        check(!sd.syncFile(), "failed sync reported");
+        check(sd.getState() == LoggerSD::State::DEGRADED, "card degraded after a failed sync");
+        sd.appendRecord("sync.log", "{\"sync\":2}");
+        check(sd.syncFile() && sd.getState() == LoggerSD::State::PRESENT, "card recovers with the next sync");
+    }
+
+    // random bus failures: every record on the card is either valid or detected as damaged
+    {
+        LoggerSD sd;
+        sd.init();
+        randomSeed(1);
+        emulator.setFailureRate(2);
+        for (size_t i = 0; i < 300; i++) {
+            if (!sd.available()) sd.init();
+            sd.appendRecord("noisy.log", String::format("{\"noisy\":%d}", (int) i).c_str());
+            if (i % 16 == 15) sd.syncFile();
+        }
+        emulator.setFailureRate(0);
+        if (!sd.available()) sd.init();
+        sd.syncFile();
+        Frames frames = parseFrames(readCard("noisy.log"));
+        bool increasing = true;
+        for (int i = 1; i < frames.seqs.size(); i++) increasing = increasing && frames.seqs[i] > frames.seqs[i - 1];
+        check(frames.seqs.size() > 0 && increasing, "records written despite bus failures have increasing sequence numbers");
+        Log.info("SD: with 2%% transaction failures %d records valid, %d damaged lines", frames.seqs.size(), (int) frames.damaged);
+    }
+
+    // log segments: rotation, retention, export and recovery from the index checkpoint
+    {
+        LoggerSD sd;
+        sd.init();
+        LoggerSDLog log(&sd, "seg", 2048, 0, 4);
+        for (size_t i = 0; i < 300; i++) {
+            check(log.append(String::format("{\"seg\":%d}", (int) i).c_str()), "log append");
+            if (i % 32 == 31) sd.syncFile();
+        }
+        sd.syncFile();
+        Variant info = log.getInfo();
+        check(info.get("segments").toInt() <= 5, "retention keeps at most max_segments (+ the one being written)");
+        Collector out;
+        size_t bytes = log.exportRange(0, UINT32_MAX, out);
+        Frames frames = parseFrames(out.text);
+        check(bytes > 0 && frames.damaged == 0 && frames.seqs.size() > 0 && frames.seqs.last() == 299, "export ends with the last record");
+        check(isSequence(frames.seqs, frames.seqs.first()), "export is a consecutive run of records");
+        Log.info("SD log: %s, export of %d records (%d B)", info.toJSON().c_str(), frames.seqs.size(), (int) bytes);
+    }
+    {
+        LoggerSD sd;
+        sd.init();
+        LoggerSDLog log(&sd, "seg", 2048, 0, 4);
+        check(log.append("{\"seg\":\"restart\"}") && sd.syncFile(), "log append after a restart");
+        check(sd.getRecordSeq() == 301, "log sequence continues after a restart");
+    }
+
+    // flash usage tracking of the emulator (the card lives on the flash file system on the device)
+    float flash_after = LoggerPlatform::getUsedFlash();
+    check(flash_after > flash_before, "emulator writes are tracked in the flash usage");
+    emulator.format();
+    check(LoggerPlatform::getUsedFlash() == flash_before, "formatting the card frees the tracked flash");
+
+    // throughput with the latency model (defaults: 50 us per transaction, 5 ms per sync)
+    {
+        emulator.setLatency(50, 5);
+        LoggerSD sd;
+        sd.init();
+        Variant results = sd.benchmark("bench.log", 4096);
+        check(results.has("bulk_100k") && results.get("bulk_100k").toDouble() > results.get("byte_100k").toDouble(), "bulk writes are faster than byte writes");
+        Log.info("SD throughput (B/s): %s", results.toJSON().c_str());
+    }
+
+    // clean up
+    emulator.format();
+    rmdir(dir);
+
+    Log.info("HOST: %d checks, %d failures", (int) checks, (int) failures);
+    return(failures > 0 ? 1 : 0);
+}